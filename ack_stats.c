@@ -0,0 +1,67 @@
+#include "ack_stats.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+static uint16_t ack_frequency = 0;
+static int max_ack_delay_ms = 0;
+static bool ack_stats = false;
+
+void set_ack_frequency(double fraction)
+{
+    // quicly expresses the ACK frequency in 1/1024 of the congestion window
+    ack_frequency = fraction * 1024;
+    if(ack_frequency == 0) {
+        ack_frequency = 1;
+    }
+}
+
+void set_max_ack_delay(int ms)
+{
+    max_ack_delay_ms = ms;
+}
+
+void enable_ack_stats()
+{
+    ack_stats = true;
+}
+
+bool ack_stats_enabled()
+{
+    return ack_stats;
+}
+
+void setup_ack_settings(quicly_context_t *ctx)
+{
+    if(max_ack_delay_ms != 0) {
+        ctx->transport_params.max_ack_delay = max_ack_delay_ms;
+    }
+    if(ack_frequency != 0) {
+        ctx->ack_frequency = ack_frequency;
+        // advertising a min_ack_delay is what lets the peer send ACK_FREQUENCY frames to us
+        ctx->transport_params.min_ack_delay_usec = 1000;
+    }
+}
+
+static double per_packet(uint64_t acks, uint64_t packets)
+{
+    return packets != 0 ? (double)acks / packets : 0;
+}
+
+void ack_stats_report(quicly_conn_t *conn, ack_counters *last, const char *prefix)
+{
+    quicly_stats_t stats;
+    quicly_get_stats(conn, &stats);
+
+    uint64_t packets_sent = stats.num_packets.sent - last->packets_sent;
+    uint64_t packets_received = stats.num_packets.received - last->packets_received;
+    uint64_t acks_sent = stats.num_frames_sent.ack - last->acks_sent;
+    uint64_t acks_received = stats.num_frames_received.ack - last->acks_received;
+    printf("%s acks sent: %" PRIu64 " (%.3f per received packet) acks received: %" PRIu64 " (%.3f per sent packet)\n", prefix,
+           acks_sent, per_packet(acks_sent, packets_received), acks_received, per_packet(acks_received, packets_sent));
+
+    last->packets_sent = stats.num_packets.sent;
+    last->packets_received = stats.num_packets.received;
+    last->acks_sent = stats.num_frames_sent.ack;
+    last->acks_received = stats.num_frames_received.ack;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <quicly.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct
+{
+    uint64_t packets_sent;
+    uint64_t packets_received;
+    uint64_t acks_sent;
+    uint64_t acks_received;
+} ack_counters;
+
+/* fraction of the congestion window after which the peer is asked to acknowledge, 0 keeps quicly's default */
+void set_ack_frequency(double fraction);
+/* advertised max_ack_delay in milliseconds, 0 keeps quicly's default */
+void set_max_ack_delay(int ms);
+void enable_ack_stats();
+bool ack_stats_enabled();
+void setup_ack_settings(quicly_context_t *ctx);
+/* prints ACK frames sent and received since the last report, relative to the packets received and sent */
+void ack_stats_report(quicly_conn_t *conn, ack_counters *last, const char *prefix);
@@ -0,0 +1,551 @@
+#include "stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include <limits.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_VALUES 16
+#define MAX_REPEAT 100
+#define MAX_CONNECTIONS 64
+/* MAX_SEND_BATCH_SIZE of qperf */
+#define MAX_BATCH 64
+/* a client gets this long on top of its runtime before it is killed */
+#define CLIENT_GRACE_SECONDS 10
+
+typedef struct
+{
+    const char *values[MAX_VALUES];
+    int num_values;
+} value_list;
+
+typedef struct
+{
+    const char *cc;
+    const char *iw;
+    const char *gso;
+    const char *batch;
+    const char *bytes;
+    const char *connections;
+} cell;
+
+typedef struct
+{
+    double mean;
+    double ci; // half width of the 95% confidence interval
+    int num;
+} estimate;
+
+typedef struct
+{
+    double throughput_mbit;
+    double fct_ms;  // 0 for runs without --bytes
+    double ttfb_ms;
+} run_result;
+
+static const char *qperf_path = NULL;
+static const char *cert_dir = ".";
+static int port = 18180;
+static int runtime_s = 5;
+static int repeat = 5;
+
+static void usage(const char *cmd)
+{
+    printf("Usage: %s [options]\n"
+            "\n"
+            "Runs qperf server and clients on loopback for every combination of the given values.\n"
+            "Lists are comma separated.\n"
+            "\n"
+            "Options:\n"
+            "  --baseline file      compare with a csv file written by an earlier run, exit with 2 on regressions\n"
+            "  --batch list         datagrams per send batch (default 16)\n"
+            "  --bytes list         transfer size, 0 for a bulk transfer of -t seconds (default 0)\n"
+            "  --cc list            congestion control algorithms (default reno)\n"
+            "  --certs dir          directory with server.crt and server.key (default .)\n"
+            "  --connections list   number of concurrent client processes (default 1)\n"
+            "  --csv file           write the results to file instead of stdout\n"
+            "  --gso list           off, on (default off)\n"
+            "  --iw list            initial windows (default 10)\n"
+            "  -p port              port of the server (default 18180)\n"
+            "  --qperf path         qperf executable (default: next to this executable)\n"
+            "  --repeat n           runs per combination (default 5)\n"
+            "  -t time (s)          runtime of bulk transfers (default 5)\n"
+            "  --threshold percent  allowed throughput decrease and latency increase against --baseline (default 5)\n"
+            "  -h                   print this help\n"
+            "\n",
+           cmd);
+}
+
+static void parse_list(value_list *list, char *src)
+{
+    list->num_values = 0;
+    for(char *save, *value = strtok_r(src, ",", &save); value != NULL; value = strtok_r(NULL, ",", &save)) {
+        if(list->num_values == MAX_VALUES) {
+            fprintf(stderr, "more than %d values in a list\n", MAX_VALUES);
+            exit(1);
+        }
+        list->values[list->num_values++] = value;
+    }
+    if(list->num_values == 0) {
+        fprintf(stderr, "empty list\n");
+        exit(1);
+    }
+}
+
+static double now_s()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static pid_t spawn(char **argv, int out_fd, const char *dir)
+{
+    pid_t pid = fork();
+    if(pid == -1) {
+        perror("fork failed");
+        exit(1);
+    }
+    if(pid == 0) {
+        dup2(out_fd, STDOUT_FILENO);
+        dup2(out_fd, STDERR_FILENO);
+        if(dir != NULL && chdir(dir) != 0) {
+            perror("chdir failed");
+            _exit(127);
+        }
+        execv(argv[0], argv);
+        perror("execv failed");
+        _exit(127);
+    }
+    return pid;
+}
+
+static bool port_in_use()
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    struct sockaddr_in sin = {.sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    bool in_use = bind(fd, (struct sockaddr *)&sin, sizeof(sin)) != 0 && errno == EADDRINUSE;
+    close(fd);
+    return in_use;
+}
+
+/* waits for a child, kills it after the deadline, returns its exit status or -1 */
+static int wait_child(pid_t pid, double deadline)
+{
+    int status;
+    while(waitpid(pid, &status, WNOHANG) == 0) {
+        if(now_s() > deadline) {
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+            return -1;
+        }
+        usleep(20000);
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static void add_common_args(char **argv, int *argc, const cell *c, char *port_str)
+{
+    argv[(*argc)++] = "-p";
+    argv[(*argc)++] = port_str;
+    argv[(*argc)++] = "--cc";
+    argv[(*argc)++] = (char *)c->cc;
+    argv[(*argc)++] = "--iw";
+    argv[(*argc)++] = (char *)c->iw;
+    argv[(*argc)++] = "--batch";
+    argv[(*argc)++] = (char *)c->batch;
+    if(strcmp(c->gso, "on") == 0) {
+        argv[(*argc)++] = "-g";
+    }
+}
+
+static bool parse_client_output(FILE *f, run_result *result, double *bytes_per_s)
+{
+    char line[512];
+    uint64_t bytes, total_bytes = 0, transfer_bytes;
+    int second, num_seconds = 0, n;
+    unsigned long ttfb;
+    double fct;
+    bool have_ttfb = false, have_fct = false;
+
+    rewind(f);
+    while(fgets(line, sizeof(line), f) != NULL) {
+        char *open = strchr(line, '(');
+        if(sscanf(line, "time to first byte: %lums", &ttfb) == 1) {
+            result->ttfb_ms = ttfb;
+            have_ttfb = true;
+        } else if(sscanf(line, "transfer of %" SCNu64 " bytes completed in %lfms", &transfer_bytes, &fct) == 2) {
+            result->fct_ms = fct;
+            *bytes_per_s = transfer_bytes / (fct / 1000);
+            have_fct = true;
+        } else if((n = 0, sscanf(line, "second %i:%n", &second, &n)) == 1 && n != 0 && open != NULL &&
+                  (n = 0, sscanf(open, "(%" SCNu64 " bytes %n", &bytes, &n)) == 1 && n != 0) {
+            total_bytes += bytes;
+            ++num_seconds;
+        }
+    }
+
+    if(!have_fct) {
+        if(num_seconds == 0) {
+            return false;
+        }
+        *bytes_per_s = (double)total_bytes / num_seconds;
+    }
+    return have_ttfb;
+}
+
+static bool run_once(const cell *c, run_result *result)
+{
+    char port_str[16], runtime_str[16];
+    sprintf(port_str, "%i", port);
+    sprintf(runtime_str, "%i", runtime_s);
+
+    char *server_argv[32];
+    int server_argc = 0;
+    server_argv[server_argc++] = (char *)qperf_path;
+    server_argv[server_argc++] = "-s";
+    server_argv[server_argc++] = "127.0.0.1";
+    add_common_args(server_argv, &server_argc, c, port_str);
+    server_argv[server_argc] = NULL;
+
+    int null_fd = open("/dev/null", O_WRONLY);
+    pid_t server = spawn(server_argv, null_fd, cert_dir);
+    close(null_fd);
+
+    // the server is ready once it holds the port
+    double deadline = now_s() + 5;
+    while(!port_in_use()) {
+        if(now_s() > deadline || waitpid(server, NULL, WNOHANG) != 0) {
+            fprintf(stderr, "server did not start, are server.crt and server.key in %s?\n", cert_dir);
+            kill(server, SIGKILL);
+            waitpid(server, NULL, 0);
+            return false;
+        }
+        usleep(10000);
+    }
+
+    char *client_argv[32];
+    int client_argc = 0;
+    client_argv[client_argc++] = (char *)qperf_path;
+    client_argv[client_argc++] = "-c";
+    client_argv[client_argc++] = "127.0.0.1";
+    client_argv[client_argc++] = "-t";
+    client_argv[client_argc++] = runtime_str;
+    add_common_args(client_argv, &client_argc, c, port_str);
+    if(strcmp(c->bytes, "0") != 0) {
+        client_argv[client_argc++] = "--bytes";
+        client_argv[client_argc++] = (char *)c->bytes;
+    }
+    client_argv[client_argc] = NULL;
+
+    int num_clients = atoi(c->connections);
+    pid_t clients[MAX_CONNECTIONS];
+    FILE *outputs[MAX_CONNECTIONS];
+    for(int i = 0; i < num_clients; ++i) {
+        outputs[i] = tmpfile();
+        clients[i] = spawn(client_argv, fileno(outputs[i]), NULL);
+    }
+
+    bool ok = true;
+    memset(result, 0, sizeof(*result));
+    deadline = now_s() + runtime_s + CLIENT_GRACE_SECONDS;
+    double total_bytes_per_s = 0;
+    for(int i = 0; i < num_clients; ++i) {
+        run_result client_result = {0};
+        double bytes_per_s = 0;
+        if(wait_child(clients[i], deadline) != 0 || !parse_client_output(outputs[i], &client_result, &bytes_per_s)) {
+            fprintf(stderr, "client %i failed\n", i);
+            ok = false;
+        }
+        fclose(outputs[i]);
+        total_bytes_per_s += bytes_per_s;
+        result->fct_ms += client_result.fct_ms / num_clients;
+        result->ttfb_ms += client_result.ttfb_ms / num_clients;
+    }
+    result->throughput_mbit = total_bytes_per_s * 8 / 1e6;
+
+    kill(server, SIGTERM);
+    wait_child(server, now_s() + 2);
+    return ok;
+}
+
+static estimate estimate_mean(const double *values, int num)
+{
+    estimate e = {0, 0, num};
+    if(num == 0) {
+        return e;
+    }
+    for(int i = 0; i < num; ++i) {
+        e.mean += values[i] / num;
+    }
+    if(num > 1) {
+        double var = 0;
+        for(int i = 0; i < num; ++i) {
+            var += (values[i] - e.mean) * (values[i] - e.mean) / (num - 1);
+        }
+        e.ci = t_quantile_975(num - 1) * sqrt(var / num);
+    }
+    return e;
+}
+
+static void cell_key(char *dst, const cell *c)
+{
+    sprintf(dst, "%s,%s,%s,%s,%s,%s", c->cc, c->iw, c->gso, c->batch, c->bytes, c->connections);
+}
+
+typedef struct
+{
+    char key[256];
+    double throughput_mbit;
+    double fct_ms;
+    double ttfb_ms;
+} baseline_entry;
+
+static baseline_entry *baseline = NULL;
+static size_t baseline_len = 0;
+
+static bool load_baseline(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if(f == NULL) {
+        fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    char line[1024];
+    while(fgets(line, sizeof(line), f) != NULL) {
+        // cc,iw,gso,batch,bytes,connections,runs,throughput_mbit,throughput_ci,fct_ms,fct_ci,ttfb_ms,ttfb_ci
+        char *fields[13];
+        int num_fields = 0;
+        for(char *save, *field = strtok_r(line, ",\n", &save); field != NULL && num_fields < 13; field = strtok_r(NULL, ",\n", &save)) {
+            fields[num_fields++] = field;
+        }
+        if(num_fields != 13 || strcmp(fields[0], "cc") == 0) {
+            continue;
+        }
+
+        baseline = realloc(baseline, (baseline_len + 1) * sizeof(*baseline));
+        baseline_entry *e = &baseline[baseline_len++];
+        snprintf(e->key, sizeof(e->key), "%s,%s,%s,%s,%s,%s", fields[0], fields[1], fields[2], fields[3], fields[4], fields[5]);
+        e->throughput_mbit = atof(fields[7]);
+        e->fct_ms = atof(fields[9]);
+        e->ttfb_ms = atof(fields[11]);
+    }
+    fclose(f);
+    return true;
+}
+
+static const baseline_entry *find_baseline(const char *key)
+{
+    for(size_t i = 0; i < baseline_len; ++i) {
+        if(strcmp(baseline[i].key, key) == 0) {
+            return &baseline[i];
+        }
+    }
+    return NULL;
+}
+
+/* a regression has to exceed the threshold and lie outside the confidence interval of this run */
+static bool check_regression(const char *key, const char *metric, estimate value, double base, bool higher_is_better, double threshold)
+{
+    if(base == 0 || fabs(value.mean - base) <= value.ci) {
+        return false;
+    }
+    double change = (value.mean - base) / base * 100;
+    if(higher_is_better ? change < -threshold : change > threshold) {
+        fprintf(stderr, "regression in %s: %s %.3f vs baseline %.3f (%+.1f%%)\n", key, metric, value.mean, base, change);
+        return true;
+    }
+    return false;
+}
+
+static struct option long_options[] =
+{
+    {"cc", required_argument, NULL, 0},
+    {"iw", required_argument, NULL, 1},
+    {"gso", required_argument, NULL, 2},
+    {"batch", required_argument, NULL, 3},
+    {"bytes", required_argument, NULL, 4},
+    {"connections", required_argument, NULL, 5},
+    {"repeat", required_argument, NULL, 6},
+    {"csv", required_argument, NULL, 7},
+    {"baseline", required_argument, NULL, 8},
+    {"threshold", required_argument, NULL, 9},
+    {"qperf", required_argument, NULL, 10},
+    {"certs", required_argument, NULL, 11},
+    {NULL, 0, NULL, 0}
+};
+
+int main(int argc, char **argv)
+{
+    value_list ccs = {{"reno"}, 1}, iws = {{"10"}, 1}, gsos = {{"off"}, 1}, batches = {{"16"}, 1}, bytes = {{"0"}, 1},
+               connections = {{"1"}, 1};
+    const char *csv_path = NULL;
+    const char *baseline_path = NULL;
+    double threshold = 5;
+    int ch;
+
+    while((ch = getopt_long(argc, argv, "p:t:h", long_options, NULL)) != -1) {
+        switch(ch) {
+        case 0:
+            parse_list(&ccs, optarg);
+            break;
+        case 1:
+            parse_list(&iws, optarg);
+            break;
+        case 2:
+            parse_list(&gsos, optarg);
+            break;
+        case 3:
+            parse_list(&batches, optarg);
+            for(int i = 0; i < batches.num_values; ++i) {
+                int n = atoi(batches.values[i]);
+                if(n < 1 || n > MAX_BATCH) {
+                    fprintf(stderr, "invalid argument passed to --batch\n");
+                    exit(1);
+                }
+            }
+            break;
+        case 4:
+            parse_list(&bytes, optarg);
+            break;
+        case 5:
+            parse_list(&connections, optarg);
+            for(int i = 0; i < connections.num_values; ++i) {
+                int n = atoi(connections.values[i]);
+                if(n < 1 || n > MAX_CONNECTIONS) {
+                    fprintf(stderr, "invalid argument passed to --connections\n");
+                    exit(1);
+                }
+            }
+            break;
+        case 6:
+            if(sscanf(optarg, "%u", &repeat) != 1 || repeat < 1 || repeat > MAX_REPEAT) {
+                fprintf(stderr, "invalid argument passed to --repeat\n");
+                exit(1);
+            }
+            break;
+        case 7:
+            csv_path = optarg;
+            break;
+        case 8:
+            baseline_path = optarg;
+            break;
+        case 9:
+            if(sscanf(optarg, "%lf", &threshold) != 1 || threshold < 0) {
+                fprintf(stderr, "invalid argument passed to --threshold\n");
+                exit(1);
+            }
+            break;
+        case 10:
+            qperf_path = optarg;
+            break;
+        case 11:
+            cert_dir = optarg;
+            break;
+        case 'p':
+            if(sscanf(optarg, "%u", &port) != 1 || port < 1 || port > 65535) {
+                fprintf(stderr, "invalid argument passed to -p\n");
+                exit(1);
+            }
+            break;
+        case 't':
+            if(sscanf(optarg, "%u", &runtime_s) != 1 || runtime_s < 1) {
+                fprintf(stderr, "invalid argument passed to -t\n");
+                exit(1);
+            }
+            break;
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    if(qperf_path == NULL) {
+        // qperf is built next to qperf-bench
+        static char path[PATH_MAX];
+        ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - strlen("/qperf") - 1);
+        if(len == -1) {
+            perror("readlink failed, use --qperf");
+            exit(1);
+        }
+        path[len] = '\0';
+        strcat(dirname(path), "/qperf");
+        qperf_path = path;
+    }
+
+    if(baseline_path != NULL && !load_baseline(baseline_path)) {
+        exit(1);
+    }
+
+    FILE *csv = stdout;
+    if(csv_path != NULL && (csv = fopen(csv_path, "w")) == NULL) {
+        fprintf(stderr, "failed to open %s: %s\n", csv_path, strerror(errno));
+        exit(1);
+    }
+    fprintf(csv, "cc,iw,gso,batch,bytes,connections,runs,throughput_mbit,throughput_ci,fct_ms,fct_ci,ttfb_ms,ttfb_ci\n");
+    fflush(csv);
+
+    bool regressed = false;
+    for(int a = 0; a < ccs.num_values; ++a)
+    for(int b = 0; b < iws.num_values; ++b)
+    for(int g = 0; g < gsos.num_values; ++g)
+    for(int s = 0; s < batches.num_values; ++s)
+    for(int m = 0; m < bytes.num_values; ++m)
+    for(int n = 0; n < connections.num_values; ++n) {
+        cell c = {ccs.values[a], iws.values[b], gsos.values[g], batches.values[s], bytes.values[m], connections.values[n]};
+        char key[256];
+        cell_key(key, &c);
+
+        double throughputs[MAX_REPEAT], fcts[MAX_REPEAT], ttfbs[MAX_REPEAT];
+        int num_runs = 0;
+        for(int r = 0; r < repeat; ++r) {
+            run_result result;
+            fprintf(stderr, "%s run %i/%i\n", key, r + 1, repeat);
+            if(run_once(&c, &result)) {
+                throughputs[num_runs] = result.throughput_mbit;
+                fcts[num_runs] = result.fct_ms;
+                ttfbs[num_runs] = result.ttfb_ms;
+                ++num_runs;
+            }
+        }
+
+        estimate throughput = estimate_mean(throughputs, num_runs);
+        estimate fct = estimate_mean(fcts, num_runs);
+        estimate ttfb = estimate_mean(ttfbs, num_runs);
+        fprintf(csv, "%s,%i,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n", key, num_runs, throughput.mean, throughput.ci, fct.mean, fct.ci,
+                ttfb.mean, ttfb.ci);
+        fflush(csv);
+
+        if(num_runs == 0) {
+            fprintf(stderr, "all runs of %s failed\n", key);
+            regressed = true;
+            continue;
+        }
+        const baseline_entry *base = find_baseline(key);
+        if(base != NULL) {
+            regressed |= check_regression(key, "throughput_mbit", throughput, base->throughput_mbit, true, threshold);
+            regressed |= check_regression(key, "fct_ms", fct, base->fct_ms, false, threshold);
+            regressed |= check_regression(key, "ttfb_ms", ttfb, base->ttfb_ms, false, threshold);
+        }
+    }
+
+    if(csv != stdout) {
+        fclose(csv);
+    }
+    return regressed ? 2 : 0;
+}
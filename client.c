@@ -1,6 +1,18 @@
 #include "client.h"
 #include "client_stream.h"
+#include "client_probe.h"
+#include "client_datagram.h"
+#include "client_workload.h"
+#include "client_idle.h"
+#include "client_migration.h"
 #include "common.h"
+#include "timestamps.h"
+#include "socket_stats.h"
+#include "ack_stats.h"
+#include "ecn.h"
+#include "run_summary.h"
+#include "rx_thread.h"
+#include "trace.h"
 
 #include <ev.h>
 #include <stdio.h>
@@ -11,11 +23,15 @@
 #include <errno.h>
 #include <stdbool.h>
 #include <float.h>
+#include <limits.h>
+#include <sys/wait.h>
 #include <quicly/streambuf.h>
 
 #include <picotls/../../t/util.h>
 
 static int client_socket = -1;
+static int client_family = AF_UNSPEC;
+static ev_io socket_watcher;
 static quicly_conn_t *conn = NULL;
 static ev_timer client_timeout;
 static quicly_context_t client_ctx;
@@ -24,6 +40,15 @@ static int64_t start_time = 0;
 static int64_t connect_time = 0;
 static bool quit_after_first_byte = false;
 static ptls_iovec_t resumption_token;
+static int probe_interval_ms = 0;
+static transfer_params transfer = {.upload = false, .bytes = 0, .duration_s = 0};
+static ev_timer request_timer;
+static rx_timestamps client_rx_timestamps;
+static socket_stats client_socket_stats;
+static ack_counters client_ack_counters;
+static ecn_counters client_ecn_counters;
+static int client_cpu = -1;
+static trace_conn client_trace;
 
 void client_timeout_cb(EV_P_ ev_timer *w, int revents);
 
@@ -35,8 +60,9 @@ void client_refresh_timeout()
     ev_timer_again(EV_DEFAULT, &client_timeout);
 }
 
-void client_timeout_cb(EV_P_ ev_timer *w, int revents)
+void client_send_pending()
 {
+    trace_conn_update(conn, &client_trace);
     if(!send_pending(&client_ctx, client_socket, conn)) {
         quicly_free(conn);
         exit(0);
@@ -45,62 +71,96 @@ void client_timeout_cb(EV_P_ ev_timer *w, int revents)
     client_refresh_timeout();
 }
 
+void client_timeout_cb(EV_P_ ev_timer *w, int revents)
+{
+    client_send_pending();
+}
+
+static void client_receive_dgram(const uint8_t *buf, size_t len, struct sockaddr *sa, const recv_info *info)
+{
+    quicly_decoded_packet_t packet;
+
+    client_migration_on_packet();
+    rx_timestamps_record(&client_rx_timestamps, info);
+    socket_stats_record(&client_socket_stats, info);
+    for(size_t offset = 0; offset < len; ) {
+        size_t packet_len = quicly_decode_packet(&client_ctx, &packet, buf, len, &offset);
+        if(packet_len == SIZE_MAX) {
+            break;
+        }
+        packet.ecn = info->ecn;
+
+        // handle packet --------------------------------------------------
+        int ret = quicly_receive(conn, NULL, sa, &packet);
+        if(ret != 0 && ret != QUICLY_ERROR_PACKET_IGNORED) {
+            fprintf(stderr, "quicly_receive returned %i\n", ret);
+            exit(1);
+        }
+        trace_packet_received(conn, packet.octets.len);
+
+        // check if connection ready --------------------------------------
+        if(connect_time == 0 && quicly_connection_is_ready(conn)) {
+            connect_time = client_ctx.now->cb(client_ctx.now);
+            int64_t establish_time = connect_time - start_time;
+            printf("connection establishment time: %lums\n", establish_time);
+        }
+    }
+}
+
+static void client_rx_packet_cb(const rx_packet *p)
+{
+    client_receive_dgram(p->buf, p->len, (struct sockaddr *)&p->sa, &p->info);
+}
+
 void client_read_cb(EV_P_ ev_io *w, int revents)
 {
     // retrieve data
     uint8_t buf[4096];
     struct sockaddr_storage sa;
     socklen_t salen = sizeof(sa);
-    quicly_decoded_packet_t packet;
+    recv_info info;
     ssize_t bytes_received;
 
-    while((bytes_received = recvfrom(w->fd, buf, sizeof(buf), MSG_DONTWAIT,(struct sockaddr *) &sa, &salen)) != -1) {
-        for(size_t offset = 0; offset < bytes_received; ) {
-            size_t packet_len = quicly_decode_packet(&client_ctx, &packet, buf, bytes_received, &offset);
-            if(packet_len == SIZE_MAX) {
-                break;
-            }
-
-            // handle packet --------------------------------------------------
-            int ret = quicly_receive(conn, NULL, (struct sockaddr *) &sa, &packet);
-            if(ret != 0 && ret != QUICLY_ERROR_PACKET_IGNORED) {
-                fprintf(stderr, "quicly_receive returned %i\n", ret);
-                exit(1);
-            }
-
-            // check if connection ready --------------------------------------
-            if(connect_time == 0 && quicly_connection_is_ready(conn)) {
-                connect_time = client_ctx.now->cb(client_ctx.now);
-                int64_t establish_time = connect_time - start_time;
-                printf("connection establishment time: %lums\n", establish_time);
-            }
-        }
+    while((bytes_received = receive_dgram(w->fd, buf, sizeof(buf), &sa, &salen, &info)) != -1) {
+        client_receive_dgram(buf, bytes_received, (struct sockaddr *)&sa, &info);
     }
 
     if(errno != EWOULDBLOCK && errno != 0) {
         perror("recvfrom failed");
     }
 
-    if(!send_pending(&client_ctx, client_socket, conn)) {
-        quicly_free(conn);
-        exit(0);
-    }
-
-    client_refresh_timeout();
+    client_send_pending();
 }
 
 void enqueue_request(quicly_conn_t *conn)
 {
+    if(client_workload_enabled()) {
+        client_workload_start(conn, &transfer);
+        return;
+    }
+
+    if(!client_datagrams_enabled()) {
+        client_open_transfer(conn, &transfer);
+        return;
+    }
+
     quicly_stream_t *stream;
     int ret = quicly_open_stream(conn, &stream, 0);
     assert(ret == 0);
-    const char *req = "qperf start sending";
+    char req[64];
+    sprintf(req, DATAGRAM_REQUEST " %" PRIu64, client_datagram_rate());
 
-    
     quicly_streambuf_egress_write(stream, req, strlen(req));
     quicly_streambuf_egress_shutdown(stream);
 }
 
+static void request_timer_cb(EV_P_ ev_timer *w, int revents)
+{
+    // idle phase is over, start the bulk transfer while probes keep running
+    enqueue_request(conn);
+    client_send_pending();
+}
+
 static void client_on_conn_close(quicly_closed_by_remote_t *self, quicly_conn_t *conn, quicly_error_t err,
                                  uint64_t frame_type, const char *reason, size_t reason_len)
 {
@@ -121,6 +181,8 @@ static quicly_stream_open_t stream_open = {&client_on_stream_open};
 
 static quicly_closed_by_remote_t closed_by_remote = {&client_on_conn_close};
 
+static quicly_receive_datagram_frame_t receive_datagram_frame = {&client_datagram_receive};
+
 int run_client(const char *port, bool gso, const char *logfile, const char *cc, int iw, const char *host, int runtime_s, bool ttfb_only)
 {
     setup_session_cache(get_tlsctx());
@@ -134,6 +196,13 @@ int run_client(const char *port, bool gso, const char *logfile, const char *cc,
     client_ctx.transport_params.max_stream_data.bidi_local = UINT32_MAX;
     client_ctx.transport_params.max_stream_data.bidi_remote = UINT32_MAX;
     client_ctx.initcwnd_packets = iw;
+    setup_ack_settings(&client_ctx);
+    setup_ecn_settings(&client_ctx);
+
+    if(client_datagrams_enabled()) {
+        client_ctx.transport_params.max_datagram_frame_size = UINT16_MAX;
+        client_ctx.receive_datagram_frame = &receive_datagram_frame;
+    }
 
     if(strcmp(cc, "reno") == 0) {
         client_ctx.init_cc = &quicly_cc_reno_init;
@@ -155,34 +224,17 @@ int run_client(const char *port, bool gso, const char *logfile, const char *cc,
     
     struct sockaddr *sa = (struct sockaddr *)&sas;
     
-    client_socket = socket(sa->sa_family, SOCK_DGRAM, IPPROTO_UDP);
+    if(client_idle_enabled()) {
+        return client_idle_run(&client_ctx, host, sa, runtime_s);
+    }
+
+    client_family = sa->sa_family;
+    client_socket = create_client_socket(client_family);
     if (client_socket == -1) {
-        perror("socket(2) failed");
         return 1;
     }
-    
-    if (sa->sa_family == AF_INET) {
-        struct sockaddr_in local;
-        memset(&local, 0, sizeof(local));
-        local.sin_family = AF_INET;
-        local.sin_addr.s_addr = INADDR_ANY;
-        local.sin_port = 0; // Let the OS choose the port
-        if (bind(client_socket, (struct sockaddr *)&local, sizeof(local)) != 0) {
-            perror("bind(2) failed");
-            return 1;
-        }
-    } else if (sa->sa_family == AF_INET6) {
-        struct sockaddr_in6 local;
-        memset(&local, 0, sizeof(local));
-        local.sin6_family = AF_INET6;
-        local.sin6_addr = in6addr_any;
-        local.sin6_port = 0; // Let the OS choose the port
-        if (bind(client_socket, (struct sockaddr *)&local, sizeof(local)) != 0) {
-            perror("bind(2) failed");
-            return 1;
-        }
-    } else {
-        fprintf(stderr, "Unknown address family\n");
+
+    if(!setup_rx_timestamps(client_socket) || !setup_socket_stats(client_socket, &client_socket_stats) || !setup_ecn(client_socket)) {
         return 1;
     }
 
@@ -201,7 +253,15 @@ int run_client(const char *port, bool gso, const char *logfile, const char *cc,
     assert(ret == 0);
     ++next_cid.master_id;
 
-    enqueue_request(conn);
+    if(probe_interval_ms > 0) {
+        printf("sending probes every %ims, bulk transfer starts after %is idle phase\n", probe_interval_ms, PROBE_IDLE_SECONDS);
+        client_probe_start(conn, probe_interval_ms);
+        ev_timer_init(&request_timer, &request_timer_cb, PROBE_IDLE_SECONDS, 0);
+        ev_timer_start(loop, &request_timer);
+    } else {
+        enqueue_request(conn);
+    }
+
     if(!send_pending(&client_ctx, client_socket, conn)) {
         printf("failed to connect: send_pending failed\n");
         exit(1);
@@ -212,14 +272,25 @@ int run_client(const char *port, bool gso, const char *logfile, const char *cc,
         exit(1);
     }
 
-    ev_io socket_watcher;
-    ev_io_init(&socket_watcher, &client_read_cb, client_socket, EV_READ);
-    ev_io_start(loop, &socket_watcher);
+    if(client_cpu != -1 && !pin_current_thread(client_cpu)) {
+        return 1;
+    }
+
+    if(rx_thread_enabled()) {
+        // the socket is drained by its own thread, this one only runs quicly
+        if(!rx_thread_start(loop, client_socket, &client_rx_packet_cb, &client_send_pending)) {
+            return 1;
+        }
+    } else {
+        ev_io_init(&socket_watcher, &client_read_cb, client_socket, EV_READ);
+        ev_io_start(loop, &socket_watcher);
+    }
 
     ev_init(&client_timeout, &client_timeout_cb);
     client_refresh_timeout();
 
-    client_set_quit_after(runtime_s);
+    // a workload runs until all of its flows completed
+    client_set_quit_after(client_workload_enabled() ? INT_MAX : runtime_s + omit_seconds());
 
     ev_run(loop, 0);
     return 0;
@@ -232,6 +303,12 @@ void quit_client()
         return;
     }
 
+    client_probe_print_summary();
+    client_datagram_print_summary();
+    client_workload_print_summary();
+    client_verify_print_summary();
+    client_migration_print_summary();
+    run_summary_print();
     quicly_close(conn, 0, "");
     if(!send_pending(&client_ctx, client_socket, conn)) {
         printf("send_pending failed during connection close");
@@ -243,8 +320,124 @@ void quit_client()
 
 void on_first_byte()
 {
-    printf("time to first byte: %lums\n", client_ctx.now->cb(client_ctx.now) - start_time);
+    int64_t ttfb = client_ctx.now->cb(client_ctx.now) - start_time;
+    printf("time to first byte: %lums\n", ttfb);
+    run_summary_on_first_byte(ttfb);
+    client_probe_on_load_start();
+    client_migration_start(conn);
     if(quit_after_first_byte) {
         quit_client();
     }
 }
+
+void client_set_transfer(const transfer_params *params)
+{
+    transfer = *params;
+}
+
+void client_set_probe_interval(int interval_ms)
+{
+    probe_interval_ms = interval_ms;
+}
+
+void client_set_cpu(int cpu)
+{
+    client_cpu = cpu;
+}
+
+void client_report_socket(int second)
+{
+    char prefix[64];
+    sprintf(prefix, "second %i socket", second);
+    if(rx_timestamps_enabled()) {
+        rx_timestamps_report(&client_rx_timestamps, prefix);
+    }
+    if(drop_stats_enabled()) {
+        socket_stats_report(&client_socket_stats, prefix);
+    }
+    if(rx_thread_enabled()) {
+        rx_thread_report(prefix);
+    }
+}
+
+void client_report_conn(int second)
+{
+    if(conn == NULL) {
+        return;
+    }
+    char prefix[64];
+    sprintf(prefix, "second %i", second);
+    if(ack_stats_enabled()) {
+        ack_stats_report(conn, &client_ack_counters, prefix);
+    }
+    if(ecn_enabled()) {
+        ecn_report(conn, &client_ecn_counters, prefix);
+    }
+}
+
+bool client_migrate_socket()
+{
+    int fd = create_client_socket(client_family);
+    if(fd == -1) {
+        return false;
+    }
+    if(!setup_rx_timestamps(fd) || !setup_socket_stats(fd, &client_socket_stats) || !setup_ecn(fd)) {
+        close(fd);
+        return false;
+    }
+
+    struct sockaddr_storage local;
+    socklen_t len = sizeof(local);
+    getsockname(fd, (struct sockaddr *)&local, &len);
+    uint16_t port = local.ss_family == AF_INET ? ((struct sockaddr_in *)&local)->sin_port : ((struct sockaddr_in6 *)&local)->sin6_port;
+    printf("migrating to local port %u\n", ntohs(port));
+
+    // packets still in flight to the old port are lost, as with a NAT rebinding
+    ev_io_stop(EV_DEFAULT, &socket_watcher);
+    close(client_socket);
+    client_socket = fd;
+    ev_io_set(&socket_watcher, client_socket, EV_READ);
+    ev_io_start(EV_DEFAULT, &socket_watcher);
+
+    client_send_pending();
+    return true;
+}
+
+int run_client_repeated(int num_runs, const char *port, bool gso, const char *logfile, const char *cc, int iw, const char *host,
+                        int runtime_s, bool ttfb_only)
+{
+    // every run is a child process, so each starts with a fresh connection and fresh state
+    run_summary runs[num_runs];
+    for(int i = 0; i < num_runs; ++i) {
+        printf("run %i of %i\n", i + 1, num_runs);
+        fflush(stdout);
+
+        int fds[2];
+        if(pipe(fds) != 0) {
+            perror("pipe failed");
+            return 1;
+        }
+        pid_t pid = fork();
+        if(pid == -1) {
+            perror("fork failed");
+            return 1;
+        }
+        if(pid == 0) {
+            close(fds[0]);
+            run_summary_set_result_fd(fds[1]);
+            exit(run_client(port, gso, logfile, cc, iw, host, runtime_s, ttfb_only));
+        }
+
+        close(fds[1]);
+        ssize_t len = read(fds[0], &runs[i], sizeof(runs[i]));
+        close(fds[0]);
+        waitpid(pid, NULL, 0);
+        if(len != sizeof(runs[i])) {
+            fprintf(stderr, "run %i did not complete\n", i + 1);
+            return 1;
+        }
+    }
+
+    run_summary_print_repeated(runs, num_runs);
+    return 0;
+}
@@ -1,9 +1,23 @@
 #pragma once
 
+#include "common.h"
+
 #include <stdbool.h>
 #include <stdint.h>
 
 int run_client(const char* port, bool gso, const char *logfile, const char *cc, int iw, const char *host, int runtime_s, bool ttfb_only);
+/* runs the client num_runs times with a new connection each and prints statistics over the runs */
+int run_client_repeated(int num_runs, const char *port, bool gso, const char *logfile, const char *cc, int iw, const char *host,
+                        int runtime_s, bool ttfb_only);
 void quit_client();
+void client_send_pending();
+void client_set_transfer(const transfer_params *params);
+void client_set_probe_interval(int interval_ms);
+/* pins the thread running the connection, -1 leaves it unpinned */
+void client_set_cpu(int cpu);
+void client_report_socket(int second);
+void client_report_conn(int second);
+/* moves the connection to a new local socket, like a NAT rebinding */
+bool client_migrate_socket();
 
 void on_first_byte();
@@ -0,0 +1,98 @@
+#include "client_datagram.h"
+#include "client_stream.h"
+#include "common.h"
+#include "timestamps.h"
+
+#include <stdio.h>
+
+static bool enabled = false;
+static uint64_t target_rate = 0;
+
+static uint64_t expected = 0; // highest sequence number received + 1
+static uint64_t total_received = 0;
+static uint64_t total_reordered = 0;
+static uint64_t report_expected = 0;
+static uint64_t report_received = 0;
+static uint64_t report_reordered = 0;
+
+// interarrival jitter as in RFC 3550, transit times are only compared to each other so clocks need not be synchronized
+static bool have_transit = false;
+static int64_t last_transit_us = 0;
+static double jitter_us = 0;
+
+void client_enable_datagrams(uint64_t rate)
+{
+    enabled = true;
+    target_rate = rate;
+}
+
+bool client_datagrams_enabled()
+{
+    return enabled;
+}
+
+uint64_t client_datagram_rate()
+{
+    return target_rate;
+}
+
+void client_datagram_receive(quicly_receive_datagram_frame_t *self, quicly_conn_t *conn, ptls_iovec_t payload)
+{
+    if(payload.len < sizeof(datagram_header)) {
+        fprintf(stderr, "received short datagram of %zu bytes\n", payload.len);
+        return;
+    }
+
+    datagram_header hdr;
+    memcpy(&hdr, payload.base, sizeof(hdr));
+
+    int64_t now = get_last_rx_time_us();
+    if(now == 0) {
+        now = get_wall_time_us();
+    }
+    int64_t transit = now - hdr.send_time_us;
+    if(have_transit) {
+        int64_t d = transit - last_transit_us;
+        jitter_us += ((d < 0 ? -d : d) - jitter_us) / 16;
+    }
+    last_transit_us = transit;
+    have_transit = true;
+
+    if(hdr.seq >= expected) {
+        expected = hdr.seq + 1;
+    } else {
+        ++total_reordered;
+    }
+    ++total_received;
+
+    client_count_bytes(payload.len);
+}
+
+void client_datagram_report(int second)
+{
+    if(!enabled) {
+        return;
+    }
+
+    uint64_t received = total_received - report_received;
+    int64_t lost = (int64_t)(expected - report_expected) - (int64_t)received;
+    printf("second %i datagrams: %" PRIu64 " received %" PRId64 " lost %" PRIu64 " reordered, jitter %.3fms\n",
+           second, received, lost, total_reordered - report_reordered, jitter_us / 1000.);
+
+    report_expected = expected;
+    report_received = total_received;
+    report_reordered = total_reordered;
+}
+
+void client_datagram_print_summary()
+{
+    if(!enabled) {
+        return;
+    }
+
+    uint64_t lost = expected - min_int64(total_received, expected);
+    printf("datagrams total: %" PRIu64 " received %" PRIu64 " lost (%.3f%%) %" PRIu64 " reordered, jitter %.3fms\n",
+           total_received, lost, expected > 0 ? lost * 100. / expected : 0.,
+           total_reordered, jitter_us / 1000.);
+    fflush(stdout);
+}
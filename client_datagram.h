@@ -0,0 +1,12 @@
+#pragma once
+
+#include <quicly.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+void client_enable_datagrams(uint64_t rate);
+bool client_datagrams_enabled();
+uint64_t client_datagram_rate();
+void client_datagram_receive(quicly_receive_datagram_frame_t *self, quicly_conn_t *conn, ptls_iovec_t payload);
+void client_datagram_report(int second);
+void client_datagram_print_summary();
@@ -0,0 +1,301 @@
+#include "client_idle.h"
+#include "common.h"
+#include "stats.h"
+#include "ecn.h"
+
+#include <ev.h>
+#include <errno.h>
+#include <stdio.h>
+#include <quicly/streambuf.h>
+
+/* connections opened per millisecond while ramping up */
+#define CONNECT_BATCH 64
+
+typedef struct
+{
+    quicly_conn_t *conn;
+    int fd;
+    quicly_stream_t *stream;
+    ev_timer keepalive_timer;
+    ev_timer timeout;
+    bool established;
+    bool dirty;
+} idle_conn;
+
+static int num_connections = 0;
+static int num_sockets = 16;
+static int keepalive_ms = 1000;
+
+static quicly_context_t *idle_ctx;
+static const char *idle_host;
+static struct sockaddr_storage server_addr;
+static int *sockets;
+static idle_conn *conns;
+static int num_opened = 0;
+static int num_established = 0;
+static int num_failed = 0;
+static uint32_t *dirty;
+static size_t num_dirty = 0;
+static uint64_t report_keepalives_sent = 0;
+static sample_set report_rtts_us;
+static int current_second = 0;
+static int runtime_s = 10;
+static ev_timer connect_timer;
+static ev_timer report_timer;
+
+void client_idle_configure(int connections, int sockets_count, int keepalive)
+{
+    num_connections = connections;
+    num_sockets = sockets_count;
+    keepalive_ms = keepalive;
+}
+
+bool client_idle_enabled()
+{
+    return num_connections > 0;
+}
+
+static void refresh_timeout(idle_conn *c)
+{
+    int64_t timeout = clamp_int64(quicly_get_first_timeout(c->conn) - idle_ctx->now->cb(idle_ctx->now), 1, 200);
+    c->timeout.repeat = timeout / 1000.;
+    ev_timer_again(EV_DEFAULT, &c->timeout);
+}
+
+static void idle_send_pending(idle_conn *c)
+{
+    if(!send_pending(idle_ctx, c->fd, c->conn)) {
+        ev_timer_stop(EV_DEFAULT, &c->timeout);
+        ev_timer_stop(EV_DEFAULT, &c->keepalive_timer);
+        quicly_free(c->conn);
+        c->conn = NULL;
+        c->stream = NULL;
+        if(c->established) {
+            --num_established;
+        }
+        ++num_failed;
+        return;
+    }
+    refresh_timeout(c);
+}
+
+static void timeout_cb(EV_P_ ev_timer *w, int revents)
+{
+    idle_send_pending(w->data);
+}
+
+static void keepalive_cb(EV_P_ ev_timer *w, int revents)
+{
+    idle_conn *c = w->data;
+    if(c->stream == NULL) {
+        return;
+    }
+
+    probe_message msg = {.seq = 0, .send_time_us = get_wall_time_us(), .send_mono_time_us = get_time_us(), .server_rx_time_us = 0};
+    quicly_streambuf_egress_write(c->stream, &msg, sizeof(msg));
+    ++report_keepalives_sent;
+    idle_send_pending(c);
+}
+
+static void idle_stream_destroy(quicly_stream_t *stream, quicly_error_t err)
+{
+    idle_conn *c = *quicly_get_data(stream->conn);
+    c->stream = NULL;
+    quicly_streambuf_destroy(stream, err);
+}
+
+static void idle_stream_send_stop(quicly_stream_t *stream, quicly_error_t err)
+{
+    fprintf(stderr, "received STOP_SENDING on keepalive stream: %li\n", err);
+}
+
+static void idle_stream_receive(quicly_stream_t *stream, size_t off, const void *src, size_t len)
+{
+    if(quicly_streambuf_ingress_receive(stream, off, src, len) != 0) {
+        return;
+    }
+
+    int64_t now = get_time_us();
+    ptls_iovec_t input = quicly_streambuf_ingress_get(stream);
+    size_t consumed = 0;
+    while(input.len - consumed >= sizeof(probe_message)) {
+        probe_message msg;
+        memcpy(&msg, input.base + consumed, sizeof(msg));
+        sample_set_add(&report_rtts_us, now - msg.send_mono_time_us);
+        consumed += sizeof(msg);
+    }
+    quicly_streambuf_ingress_shift(stream, consumed);
+}
+
+static void idle_stream_receive_reset(quicly_stream_t *stream, quicly_error_t err)
+{
+    fprintf(stderr, "received RESET_STREAM on keepalive stream: %li\n", err);
+}
+
+static const quicly_stream_callbacks_t idle_stream_callbacks = {
+    &idle_stream_destroy,
+    &quicly_streambuf_egress_shift,
+    &quicly_streambuf_egress_emit,
+    &idle_stream_send_stop,
+    &idle_stream_receive,
+    &idle_stream_receive_reset
+};
+
+static void open_conn(uint32_t i)
+{
+    idle_conn *c = &conns[i];
+    c->fd = sockets[i % num_sockets];
+
+    // the master id doubles as the index into conns when demultiplexing incoming packets
+    quicly_cid_plaintext_t cid = {.master_id = i};
+    int ret = quicly_connect(&c->conn, idle_ctx, idle_host, (struct sockaddr *)&server_addr, NULL, &cid, ptls_iovec_init(NULL, 0), NULL, NULL, NULL);
+    assert(ret == 0);
+    *quicly_get_data(c->conn) = c;
+
+    // keepalives are echoed by the server like latency probes
+    ret = quicly_open_stream(c->conn, &c->stream, 0);
+    assert(ret == 0);
+    c->stream->callbacks = &idle_stream_callbacks;
+    quicly_streambuf_egress_write(c->stream, PROBE_REQUEST, strlen(PROBE_REQUEST));
+
+    ev_init(&c->timeout, &timeout_cb);
+    c->timeout.data = c;
+    // spread keepalives so that connections do not fire in lockstep
+    double interval = keepalive_ms / 1000.;
+    ev_timer_init(&c->keepalive_timer, &keepalive_cb, interval * drand48(), interval);
+    c->keepalive_timer.data = c;
+    ev_timer_start(EV_DEFAULT, &c->keepalive_timer);
+
+    idle_send_pending(c);
+}
+
+static void connect_cb(EV_P_ ev_timer *w, int revents)
+{
+    for(int n = 0; n < CONNECT_BATCH && num_opened < num_connections; ++n) {
+        open_conn(num_opened++);
+    }
+    if(num_opened == num_connections) {
+        ev_timer_stop(EV_A_ w);
+    }
+}
+
+static void read_cb(EV_P_ ev_io *w, int revents)
+{
+    uint8_t buf[4096];
+    struct sockaddr_storage sa;
+    socklen_t salen = sizeof(sa);
+    quicly_decoded_packet_t packet;
+    recv_info info;
+    ssize_t bytes_received;
+
+    while((bytes_received = receive_dgram(w->fd, buf, sizeof(buf), &sa, &salen, &info)) != -1) {
+        for(size_t offset = 0; offset < bytes_received; ) {
+            size_t packet_len = quicly_decode_packet(idle_ctx, &packet, buf, bytes_received, &offset);
+            if(packet_len == SIZE_MAX) {
+                break;
+            }
+            packet.ecn = info.ecn;
+
+            uint32_t i = packet.cid.dest.plaintext.master_id;
+            if(i >= (uint32_t)num_opened || conns[i].conn == NULL ||
+               !quicly_is_destination(conns[i].conn, NULL, (struct sockaddr *)&sa, &packet)) {
+                continue;
+            }
+
+            idle_conn *c = &conns[i];
+            int ret = quicly_receive(c->conn, NULL, (struct sockaddr *)&sa, &packet);
+            if(ret != 0 && ret != QUICLY_ERROR_PACKET_IGNORED) {
+                fprintf(stderr, "quicly_receive returned %i\n", ret);
+            }
+            if(!c->established && quicly_connection_is_ready(c->conn)) {
+                c->established = true;
+                ++num_established;
+            }
+            if(!c->dirty) {
+                c->dirty = true;
+                dirty[num_dirty++] = i;
+            }
+        }
+    }
+
+    if(errno != EWOULDBLOCK && errno != 0) {
+        perror("recvfrom failed");
+    }
+
+    for(size_t n = 0; n < num_dirty; ++n) {
+        idle_conn *c = &conns[dirty[n]];
+        c->dirty = false;
+        if(c->conn != NULL) {
+            idle_send_pending(c);
+        }
+    }
+    num_dirty = 0;
+}
+
+static void quit_idle()
+{
+    for(int i = 0; i < num_opened; ++i) {
+        if(conns[i].conn != NULL) {
+            quicly_close(conns[i].conn, 0, "");
+            send_pending(idle_ctx, conns[i].fd, conns[i].conn);
+        }
+    }
+    printf("closed %i connections, %i failed\n", num_established, num_failed);
+    fflush(stdout);
+    exit(0);
+}
+
+static void report_cb(EV_P_ ev_timer *w, int revents)
+{
+    sample_set_sort(&report_rtts_us);
+    printf("second %i: %i connections established, %i failed, %" PRIu64 " keepalives sent, %zu answered, rtt p50 %.3fms p99 %.3fms\n",
+           current_second, num_established, num_failed, report_keepalives_sent, report_rtts_us.num_values,
+           sample_set_percentile(&report_rtts_us, 50) / 1000.,
+           sample_set_percentile(&report_rtts_us, 99) / 1000.);
+    fflush(stdout);
+
+    sample_set_clear(&report_rtts_us);
+    report_keepalives_sent = 0;
+    if(++current_second >= runtime_s) {
+        quit_idle();
+    }
+}
+
+int client_idle_run(quicly_context_t *ctx, const char *host, struct sockaddr *sa, int runtime)
+{
+    idle_ctx = ctx;
+    idle_ctx->cid_encryptor = new_cid_encryptor();
+    idle_host = host;
+    memcpy(&server_addr, sa, quicly_get_socklen(sa));
+    runtime_s = runtime;
+    srand48(get_time_us());
+
+    if(num_sockets > num_connections) {
+        num_sockets = num_connections;
+    }
+    sockets = malloc(num_sockets * sizeof(int));
+    conns = calloc(num_connections, sizeof(idle_conn));
+    dirty = malloc(num_connections * sizeof(uint32_t));
+    assert(sockets != NULL && conns != NULL && dirty != NULL);
+
+    struct ev_loop *loop = EV_DEFAULT;
+    for(int i = 0; i < num_sockets; ++i) {
+        if((sockets[i] = create_client_socket(sa->sa_family)) == -1 || !setup_ecn(sockets[i])) {
+            return 1;
+        }
+        ev_io *watcher = malloc(sizeof(ev_io));
+        ev_io_init(watcher, &read_cb, sockets[i], EV_READ);
+        ev_io_start(loop, watcher);
+    }
+
+    printf("opening %i connections to %s over %i sockets, keepalive every %ims, runtime %is\n",
+           num_connections, host, num_sockets, keepalive_ms, runtime_s);
+
+    ev_timer_init(&connect_timer, &connect_cb, 0, 0.001);
+    ev_timer_start(loop, &connect_timer);
+    ev_timer_init(&report_timer, &report_cb, 1.0, 1.0);
+    ev_timer_start(loop, &report_timer);
+
+    ev_run(loop, 0);
+    return 0;
+}
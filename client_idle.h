@@ -0,0 +1,8 @@
+#pragma once
+
+#include <quicly.h>
+#include <stdbool.h>
+
+void client_idle_configure(int num_connections, int num_sockets, int keepalive_ms);
+bool client_idle_enabled();
+int client_idle_run(quicly_context_t *ctx, const char *host, struct sockaddr *sa, int runtime_s);
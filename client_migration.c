@@ -0,0 +1,207 @@
+#include "client_migration.h"
+#include "client.h"
+#include "client_stream.h"
+#include "common.h"
+#include "stats.h"
+
+#include <ev.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+/* throughput is tracked in buckets, one window before and after a migration is compared */
+#define BUCKET_US 100000
+#define WINDOW_BUCKETS 10
+/* throughput counts as recovered once a bucket reaches this share of the rate before */
+#define RECOVERED_SHARE 0.9
+
+typedef struct
+{
+    int number;
+    int64_t time_us;
+    uint64_t bytes_before; // in the window before the migration
+    uint64_t bytes_after;
+    int64_t first_packet_us;
+    int64_t recovered_us;
+    uint32_t cwnd_before;
+    uint32_t srtt_before;
+} migration;
+
+static int first_migration_s = 0;
+static int migration_interval_s = 0;
+static quicly_conn_t *migration_conn = NULL;
+static ev_timer migration_timer;
+static ev_timer measure_timer;
+
+/* one more than the window for the bucket currently being filled */
+static uint64_t buckets[WINDOW_BUCKETS + 1];
+static int64_t bucket_start_us = 0;
+static size_t current_bucket = 0;
+
+static bool measuring = false;
+static migration current;
+static int num_migrations = 0;
+static sample_set first_packets_us;
+static sample_set recoveries_us;
+static sample_set dips_permille;
+
+void client_set_migration(int first_s, int interval_s)
+{
+    first_migration_s = first_s;
+    migration_interval_s = interval_s;
+}
+
+bool client_migration_enabled()
+{
+    return first_migration_s > 0;
+}
+
+static uint64_t window_bytes()
+{
+    // only closed buckets, so the window before a migration spans its full length
+    uint64_t bytes = 0;
+    for(size_t i = 0; i < WINDOW_BUCKETS + 1; ++i) {
+        if(i != current_bucket) {
+            bytes += buckets[i];
+        }
+    }
+    return bytes;
+}
+
+static void close_buckets(int64_t now)
+{
+    while(now >= bucket_start_us + BUCKET_US) {
+        uint64_t bytes = buckets[current_bucket];
+        if(measuring && current.recovered_us == 0 && bucket_start_us >= current.time_us &&
+           bytes * WINDOW_BUCKETS >= current.bytes_before * RECOVERED_SHARE) {
+            current.recovered_us = bucket_start_us + BUCKET_US - current.time_us;
+        }
+        bucket_start_us += BUCKET_US;
+        current_bucket = (current_bucket + 1) % (WINDOW_BUCKETS + 1);
+        buckets[current_bucket] = 0;
+    }
+}
+
+static void finish_measurement()
+{
+    if(!measuring) {
+        return;
+    }
+    measuring = false;
+    close_buckets(get_time_us());
+
+    quicly_stats_t stats;
+    quicly_get_stats(migration_conn, &stats);
+
+    char before[100], after[100];
+    int64_t window_us = BUCKET_US * WINDOW_BUCKETS;
+    format_size(before, current.bytes_before * 1000000. / window_us);
+    format_size(after, current.bytes_after * 1000000. / window_us);
+    double dip = current.bytes_before != 0 ? 1 - (double)current.bytes_after / current.bytes_before : 0;
+
+    printf("migration %i: first packet after %.1fms, throughput %s before, %s after (%.0f%% dip), ", current.number,
+           current.first_packet_us != 0 ? current.first_packet_us / 1000. : -1., before, after, dip * 100);
+    if(current.recovered_us != 0) {
+        printf("recovered after %.0fms, ", current.recovered_us / 1000.);
+    } else {
+        printf("not recovered within %ims, ", (int)(window_us / 1000));
+    }
+    printf("srtt %" PRIu32 "ms -> %" PRIu32 "ms, cwnd %" PRIu32 " -> %" PRIu32 "\n", current.srtt_before, stats.rtt.smoothed,
+           current.cwnd_before, stats.cc.cwnd);
+    fflush(stdout);
+
+    if(current.first_packet_us != 0) {
+        sample_set_add(&first_packets_us, current.first_packet_us);
+    }
+    if(current.recovered_us != 0) {
+        sample_set_add(&recoveries_us, current.recovered_us);
+    }
+    sample_set_add(&dips_permille, dip * 1000);
+}
+
+static void measure_timer_cb(EV_P_ ev_timer *w, int revents)
+{
+    finish_measurement();
+}
+
+static void migration_timer_cb(EV_P_ ev_timer *w, int revents)
+{
+    finish_measurement();
+
+    int64_t now = get_time_us();
+    close_buckets(now);
+
+    quicly_stats_t stats;
+    quicly_get_stats(migration_conn, &stats);
+    memset(&current, 0, sizeof(current));
+    current.number = num_migrations++;
+    current.time_us = now;
+    current.bytes_before = window_bytes();
+    current.cwnd_before = stats.cc.cwnd;
+    current.srtt_before = stats.rtt.smoothed;
+
+    if(!client_migrate_socket()) {
+        return;
+    }
+    measuring = true;
+    ev_timer_set(&measure_timer, BUCKET_US * WINDOW_BUCKETS / 1000000., 0);
+    ev_timer_start(EV_A_ &measure_timer);
+
+    if(migration_interval_s > 0) {
+        ev_timer_set(w, migration_interval_s, 0);
+        ev_timer_start(EV_A_ w);
+    }
+}
+
+void client_migration_start(quicly_conn_t *conn)
+{
+    if(!client_migration_enabled()) {
+        return;
+    }
+    migration_conn = conn;
+    bucket_start_us = get_time_us();
+    ev_init(&measure_timer, measure_timer_cb);
+    ev_timer_init(&migration_timer, migration_timer_cb, first_migration_s, 0);
+    ev_timer_start(EV_DEFAULT, &migration_timer);
+}
+
+void client_migration_on_packet()
+{
+    if(measuring && current.first_packet_us == 0) {
+        current.first_packet_us = get_time_us() - current.time_us;
+    }
+}
+
+void client_migration_on_bytes(size_t len)
+{
+    if(migration_conn == NULL) {
+        return;
+    }
+    close_buckets(get_time_us());
+    buckets[current_bucket] += len;
+    if(measuring) {
+        current.bytes_after += len;
+    }
+}
+
+static void print_percentiles(const char *name, sample_set *set, double scale, const char *unit)
+{
+    if(set->num_values == 0) {
+        return;
+    }
+    sample_set_sort(set);
+    printf("migration %s min/median/max: %.1f/%.1f/%.1f %s\n", name, sample_set_percentile(set, 0) / scale,
+           sample_set_percentile(set, 50) / scale, sample_set_percentile(set, 100) / scale, unit);
+}
+
+void client_migration_print_summary()
+{
+    if(migration_conn == NULL) {
+        return;
+    }
+    finish_measurement();
+    printf("migrations: %i\n", num_migrations);
+    print_percentiles("first packet", &first_packets_us, 1000, "ms");
+    print_percentiles("recovery", &recoveries_us, 1000, "ms");
+    print_percentiles("throughput dip", &dips_permille, 10, "%");
+}
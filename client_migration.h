@@ -0,0 +1,15 @@
+#pragma once
+
+#include <quicly.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* first migration after first_s seconds of transfer, then every interval_s seconds if not 0 */
+void client_set_migration(int first_s, int interval_s);
+bool client_migration_enabled();
+void client_migration_start(quicly_conn_t *conn);
+/* called for every packet received on the client socket */
+void client_migration_on_packet();
+/* called with the transfer bytes counted for the per second report */
+void client_migration_on_bytes(size_t len);
+void client_migration_print_summary();
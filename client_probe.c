@@ -0,0 +1,166 @@
+#include "client_probe.h"
+#include "client.h"
+#include "common.h"
+#include "stats.h"
+#include "timestamps.h"
+#include "trace.h"
+
+#include <ev.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <quicly/streambuf.h>
+
+typedef struct
+{
+    sample_set rtts_us;
+    sample_set forward_delays_us;
+    sample_set reverse_delays_us;
+} probe_samples;
+
+static quicly_stream_t *probe_stream = NULL;
+static ev_timer probe_timer;
+static uint64_t next_seq = 0;
+static uint64_t load_start_seq = UINT64_MAX;
+static probe_samples idle_samples;
+static probe_samples load_samples;
+static bool summary_printed = false;
+// one-way delays are only comparable to each other, the clocks of client and server are not synchronized
+static int64_t min_forward_delay_us = INT64_MAX;
+static int64_t min_reverse_delay_us = INT64_MAX;
+
+static void print_delay_trend(const char *phase, const char *direction, sample_set *delays, int64_t min_delay)
+{
+    sample_set_sort(delays);
+    printf("probe %s: %s one-way delay above minimum median %.3fms p99 %.3fms max %.3fms\n",
+           phase, direction,
+           (sample_set_percentile(delays, 50) - min_delay) / 1000.,
+           (sample_set_percentile(delays, 99) - min_delay) / 1000.,
+           (delays->values[delays->num_values - 1] - min_delay) / 1000.);
+}
+
+static void print_samples(const char *phase, probe_samples *samples)
+{
+    sample_set *rtts = &samples->rtts_us;
+    if(rtts->num_values == 0) {
+        printf("probe %s: no samples\n", phase);
+        return;
+    }
+
+    sample_set_sort(rtts);
+    int64_t median = sample_set_percentile(rtts, 50);
+    printf("probe %s: %zu samples rtt min %.3fms median %.3fms p90 %.3fms p99 %.3fms max %.3fms, %.0f round-trips per minute\n",
+           phase, rtts->num_values,
+           rtts->values[0] / 1000.,
+           median / 1000.,
+           sample_set_percentile(rtts, 90) / 1000.,
+           sample_set_percentile(rtts, 99) / 1000.,
+           rtts->values[rtts->num_values - 1] / 1000.,
+           60000000. / max_int64(median, 1));
+
+    if(samples->forward_delays_us.num_values > 0) {
+        print_delay_trend(phase, "forward", &samples->forward_delays_us, min_forward_delay_us);
+        print_delay_trend(phase, "reverse", &samples->reverse_delays_us, min_reverse_delay_us);
+    }
+}
+
+static void probe_timer_cb(EV_P_ ev_timer *w, int revents)
+{
+    if(probe_stream == NULL) {
+        return;
+    }
+
+    probe_message msg = {.seq = next_seq++, .send_time_us = get_wall_time_us(), .send_mono_time_us = get_time_us(),
+                         .server_rx_time_us = 0};
+    quicly_streambuf_egress_write(probe_stream, &msg, sizeof(msg));
+    client_send_pending();
+}
+
+static void client_probe_destroy(quicly_stream_t *stream, quicly_error_t err)
+{
+    probe_stream = NULL;
+    ev_timer_stop(EV_DEFAULT, &probe_timer);
+    trace_stream(stream, false);
+    quicly_streambuf_destroy(stream, err);
+}
+
+static void client_probe_send_stop(quicly_stream_t *stream, quicly_error_t err)
+{
+    fprintf(stderr, "received STOP_SENDING on probe stream: %li\n", err);
+}
+
+static void client_probe_receive(quicly_stream_t *stream, size_t off, const void *src, size_t len)
+{
+    if(quicly_streambuf_ingress_receive(stream, off, src, len) != 0) {
+        return;
+    }
+
+    // one-way delays prefer the kernel receive time, it excludes our own scheduling latency
+    int64_t now = get_time_us();
+    int64_t wall_now = get_last_rx_time_us();
+    if(wall_now == 0) {
+        wall_now = get_wall_time_us();
+    }
+
+    ptls_iovec_t input = quicly_streambuf_ingress_get(stream);
+    size_t consumed = 0;
+    while(input.len - consumed >= sizeof(probe_message)) {
+        probe_message msg;
+        memcpy(&msg, input.base + consumed, sizeof(msg));
+        probe_samples *samples = msg.seq >= load_start_seq ? &load_samples : &idle_samples;
+        sample_set_add(&samples->rtts_us, now - msg.send_mono_time_us);
+        if(msg.server_rx_time_us != 0) {
+            int64_t forward_delay = msg.server_rx_time_us - msg.send_time_us;
+            int64_t reverse_delay = wall_now - msg.server_rx_time_us;
+            min_forward_delay_us = min_int64(min_forward_delay_us, forward_delay);
+            min_reverse_delay_us = min_int64(min_reverse_delay_us, reverse_delay);
+            sample_set_add(&samples->forward_delays_us, forward_delay);
+            sample_set_add(&samples->reverse_delays_us, reverse_delay);
+        }
+        consumed += sizeof(msg);
+    }
+    quicly_streambuf_ingress_shift(stream, consumed);
+}
+
+static void client_probe_receive_reset(quicly_stream_t *stream, quicly_error_t err)
+{
+    fprintf(stderr, "received RESET_STREAM on probe stream: %li\n", err);
+}
+
+static const quicly_stream_callbacks_t client_probe_callbacks = {
+    &client_probe_destroy,
+    &quicly_streambuf_egress_shift,
+    &quicly_streambuf_egress_emit,
+    &client_probe_send_stop,
+    &client_probe_receive,
+    &client_probe_receive_reset
+};
+
+void client_probe_start(quicly_conn_t *conn, int interval_ms)
+{
+    // the stream_open callback sets up the streambuf, we only swap the callbacks
+    int ret = quicly_open_stream(conn, &probe_stream, 0);
+    assert(ret == 0);
+    probe_stream->callbacks = &client_probe_callbacks;
+    quicly_streambuf_egress_write(probe_stream, PROBE_REQUEST, strlen(PROBE_REQUEST));
+
+    ev_timer_init(&probe_timer, probe_timer_cb, 0, interval_ms / 1000.);
+    ev_timer_start(EV_DEFAULT, &probe_timer);
+}
+
+void client_probe_on_load_start()
+{
+    load_start_seq = next_seq;
+}
+
+void client_probe_print_summary()
+{
+    if(summary_printed || next_seq == 0) {
+        return;
+    }
+    summary_printed = true;
+    ev_timer_stop(EV_DEFAULT, &probe_timer);
+
+    print_samples("idle", &idle_samples);
+    print_samples("load", &load_samples);
+    fflush(stdout);
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <quicly.h>
+
+#define PROBE_IDLE_SECONDS 2
+
+void client_probe_start(quicly_conn_t *conn, int interval_ms);
+void client_probe_on_load_start();
+void client_probe_print_summary();
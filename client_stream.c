@@ -1,15 +1,42 @@
 #include "client_stream.h"
 #include "client.h"
 #include "common.h"
+#include "client_datagram.h"
+#include "client_workload.h"
+#include "client_migration.h"
+#include "run_summary.h"
+#include "trace.h"
 #include <ev.h>
 #include <stdbool.h>
 #include <quicly/streambuf.h>
 
+typedef struct
+{
+    quicly_streambuf_t streambuf; // must be first, quicly_streambuf_destroy frees the whole struct
+    int64_t start_time_us;
+    uint64_t bytes;
+    payload_mode payload;
+    uint64_t seed;
+    bool corrupted;
+    // upload only
+    char header[128];
+    size_t header_len;
+    uint64_t target_offset;
+    uint64_t acked_offset;
+    uint64_t max_emitted_offset;
+    int64_t deadline_us;
+} client_stream;
+
 static int current_second = 0;
 static uint64_t bytes_received = 0;
 static ev_timer report_timer;
 static bool first_receive = true;
 static int runtime_s = 10;
+static bool upload = false;
+static bool verify = false;
+static uint64_t bytes_verified = 0;
+static uint64_t bytes_corrupted = 0;
+static uint64_t streams_corrupted = 0;
 
 
 void format_size(char *dst, double bytes)
@@ -29,7 +56,12 @@ static void report_cb(EV_P_ ev_timer *w, int revents)
     char size_str[100];
     format_size(size_str, bytes_received);
 
-    printf("second %i: %s (%lu bytes received)\n", current_second, size_str, bytes_received);
+    bool omitted = !run_summary_add_interval(current_second, bytes_received);
+    printf("second %i: %s (%lu bytes %s)%s\n", current_second, size_str, bytes_received, upload ? "acked" : "received",
+           omitted ? " (omitted)" : "");
+    client_datagram_report(current_second);
+    client_report_socket(current_second);
+    client_report_conn(current_second);
     fflush(stdout);
     ++current_second;
     bytes_received = 0;
@@ -39,12 +71,30 @@ static void report_cb(EV_P_ ev_timer *w, int revents)
     }
 }
 
+static void on_transfer_complete(client_stream *s, uint64_t bytes)
+{
+    int64_t fct = get_time_us() - s->start_time_us;
+    if(client_workload_enabled()) {
+        client_workload_on_flow_complete(bytes, fct);
+        return;
+    }
+
+    printf("transfer of %" PRIu64 " bytes completed in %.3fms\n", bytes, fct / 1000.);
+    quit_client();
+}
+
+static void client_stream_destroy(quicly_stream_t *stream, quicly_error_t err)
+{
+    trace_stream(stream, false);
+    quicly_streambuf_destroy(stream, err);
+}
+
 static void client_stream_send_stop(quicly_stream_t *stream, quicly_error_t err)
 {
     fprintf(stderr, "received STOP_SENDING: %li\n", err);
 }
 
-static void client_stream_receive(quicly_stream_t *stream, size_t off, const void *src, size_t len)
+void client_count_bytes(size_t len)
 {
     if(first_receive) {
         bytes_received = 0;
@@ -54,12 +104,55 @@ static void client_stream_receive(quicly_stream_t *stream, size_t off, const voi
         on_first_byte();
     }
 
-    if(len == 0) {
+    bytes_received += len;
+    client_migration_on_bytes(len);
+}
+
+static void client_stream_receive(quicly_stream_t *stream, size_t off, const void *src, size_t len)
+{
+    client_stream *s = stream->data;
+    if(s->header_len == 0) {
+        client_count_bytes(len);
+        s->bytes += len;
+    }
+
+    if(len != 0) {
+        quicly_stream_sync_recvbuf(stream, len);
+    }
+
+    // the server only finishes download streams with a size or duration limit
+    if(s->header_len == 0 && quicly_recvstate_transfer_complete(&stream->recvstate)) {
+        on_transfer_complete(s, s->bytes);
+    }
+}
+
+static void client_stream_verify(quicly_stream_t *stream, size_t off, const void *src, size_t len)
+{
+    // reassemble in order first, the offset of out of order data would be unknown otherwise
+    client_stream *s = stream->data;
+    client_count_bytes(len);
+    s->bytes += len;
+    if(quicly_streambuf_ingress_receive(stream, off, src, len) != 0) {
         return;
     }
 
-    bytes_received += len;
-    quicly_stream_sync_recvbuf(stream, len);
+    ptls_iovec_t input = quicly_streambuf_ingress_get(stream);
+    size_t first_error;
+    size_t num_errors = payload_verify(s->payload, s->seed, stream->recvstate.data_off, input.base, input.len, &first_error);
+    if(num_errors != 0) {
+        if(!s->corrupted) {
+            printf("stream %li: payload corrupted at offset %" PRIu64 "\n", stream->stream_id, stream->recvstate.data_off + first_error);
+            s->corrupted = true;
+            ++streams_corrupted;
+        }
+        bytes_corrupted += num_errors;
+    }
+    bytes_verified += input.len;
+    quicly_streambuf_ingress_shift(stream, input.len);
+
+    if(quicly_recvstate_transfer_complete(&stream->recvstate)) {
+        on_transfer_complete(s, s->bytes);
+    }
 }
 
 static void client_stream_receive_reset(quicly_stream_t *stream, quicly_error_t err)
@@ -67,11 +160,67 @@ static void client_stream_receive_reset(quicly_stream_t *stream, quicly_error_t
     fprintf(stderr, "received RESET_STREAM: %li\n", err);
 }
 
+static void client_upload_send_shift(quicly_stream_t *stream, size_t delta)
+{
+    client_stream *s = stream->data;
+    uint64_t payload_before = max_int64(s->acked_offset, s->header_len) - s->header_len;
+    s->acked_offset += delta;
+    uint64_t payload_after = max_int64(s->acked_offset, s->header_len) - s->header_len;
+    client_count_bytes(payload_after - payload_before);
+
+    if(s->acked_offset == s->target_offset) {
+        on_transfer_complete(s, s->target_offset - s->header_len);
+    }
+}
+
+static void client_upload_send_emit(quicly_stream_t *stream, size_t off, void *dst, size_t *len, int *wrote_all)
+{
+    client_stream *s = stream->data;
+    uint64_t data_off = s->acked_offset + off;
+
+    if(s->deadline_us != 0 && s->target_offset == UINT64_MAX && get_time_us() >= s->deadline_us) {
+        s->target_offset = max_int64(s->max_emitted_offset, data_off + *len);
+    }
+
+    if(data_off + *len < s->target_offset) {
+        *wrote_all = 0;
+    } else {
+        *wrote_all = 1;
+        *len = s->target_offset - data_off;
+    }
+    s->max_emitted_offset = max_int64(s->max_emitted_offset, data_off + *len);
+
+    size_t header_part = 0;
+    if(data_off < s->header_len) {
+        header_part = min_int64(*len, s->header_len - data_off);
+        memcpy(dst, s->header + data_off, header_part);
+    }
+    payload_fill(s->payload, s->seed, data_off + header_part - s->header_len, (uint8_t *)dst + header_part, *len - header_part);
+}
+
 static const quicly_stream_callbacks_t client_stream_callbacks = {
-    &quicly_streambuf_destroy,
+    &client_stream_destroy,
+    &quicly_streambuf_egress_shift,
+    &quicly_streambuf_egress_emit,
+    &client_stream_send_stop,
+    &client_stream_receive,
+    &client_stream_receive_reset
+};
+
+static const quicly_stream_callbacks_t client_verify_callbacks = {
+    &client_stream_destroy,
     &quicly_streambuf_egress_shift,
     &quicly_streambuf_egress_emit,
     &client_stream_send_stop,
+    &client_stream_verify,
+    &client_stream_receive_reset
+};
+
+static const quicly_stream_callbacks_t client_upload_callbacks = {
+    &client_stream_destroy,
+    &client_upload_send_shift,
+    &client_upload_send_emit,
+    &client_stream_send_stop,
     &client_stream_receive,
     &client_stream_receive_reset
 };
@@ -79,15 +228,73 @@ static const quicly_stream_callbacks_t client_stream_callbacks = {
 
 quicly_error_t client_on_stream_open(quicly_stream_open_t *self, quicly_stream_t *stream)
 {
-    int ret = quicly_streambuf_create(stream, sizeof(quicly_streambuf_t));
+    int ret = quicly_streambuf_create(stream, sizeof(client_stream));
     assert(ret == 0);
     stream->callbacks = &client_stream_callbacks;
 
+    client_stream *s = stream->data;
+    s->start_time_us = get_time_us();
+    s->bytes = 0;
+    s->payload = PAYLOAD_PATTERN;
+    s->seed = 0;
+    s->corrupted = false;
+    s->header_len = 0;
+    trace_stream(stream, true);
+
     return 0;
 }
 
+quicly_stream_t *client_open_transfer(quicly_conn_t *conn, const transfer_params *params)
+{
+    quicly_stream_t *stream;
+    int ret = quicly_open_stream(conn, &stream, 0);
+    assert(ret == 0);
+    client_stream *s = stream->data;
+    s->payload = params->payload;
+    s->seed = params->seed;
+
+    char req[128];
+    format_request(req, params);
+
+    if(!params->upload) {
+        if(verify) {
+            stream->callbacks = &client_verify_callbacks;
+        }
+        quicly_streambuf_egress_write(stream, req, strlen(req));
+        quicly_streambuf_egress_shutdown(stream);
+        return stream;
+    }
+
+    // uploads send the request line followed by the payload on the same stream
+    upload = true;
+    strcpy(s->header, req);
+    s->header_len = strlen(req);
+    s->target_offset = params->bytes != 0 ? s->header_len + params->bytes : UINT64_MAX;
+    s->acked_offset = 0;
+    s->max_emitted_offset = 0;
+    s->deadline_us = params->duration_s != 0 ? s->start_time_us + params->duration_s * 1000000LL : 0;
+    stream->callbacks = &client_upload_callbacks;
+    quicly_stream_sync_sendbuf(stream, 1);
+
+    return stream;
+}
+
 
 void client_set_quit_after(int seconds)
 {
     runtime_s = seconds;
 }
+
+void client_enable_verify()
+{
+    verify = true;
+}
+
+void client_verify_print_summary()
+{
+    if(!verify) {
+        return;
+    }
+    printf("verify: %" PRIu64 " bytes checked, %" PRIu64 " bytes corrupted in %" PRIu64 " streams\n",
+           bytes_verified, bytes_corrupted, streams_corrupted);
+}
@@ -1,6 +1,15 @@
 #pragma once
 
+#include "common.h"
+
 #include <quicly.h>
 
 quicly_error_t client_on_stream_open(quicly_stream_open_t *self, quicly_stream_t *stream);
 void client_set_quit_after(int seconds);
+void client_count_bytes(size_t len);
+/* formats a per second byte count as a bit rate */
+void format_size(char *dst, double bytes);
+quicly_stream_t *client_open_transfer(quicly_conn_t *conn, const transfer_params *params);
+/* check every received byte against the requested payload, only for downloads */
+void client_enable_verify();
+void client_verify_print_summary();
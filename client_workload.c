@@ -0,0 +1,194 @@
+#include "client_workload.h"
+#include "client.h"
+#include "client_stream.h"
+#include "common.h"
+#include "stats.h"
+
+#include <ev.h>
+#include <math.h>
+#include <stdio.h>
+
+typedef struct
+{
+    double bytes;
+    double cdf;
+} cdf_point;
+
+/* flow size distributions commonly used for datacenter transport evaluations (sizes in 1460 byte packets) */
+static const cdf_point websearch_cdf[] = {
+    {6, 0}, {6, 0.15}, {13, 0.2}, {19, 0.3}, {33, 0.4}, {53, 0.53}, {133, 0.6},
+    {667, 0.7}, {1333, 0.8}, {3333, 0.9}, {6667, 0.97}, {20000, 1}
+};
+
+static const cdf_point datamining_cdf[] = {
+    {1, 0}, {1, 0.5}, {2, 0.6}, {3, 0.7}, {7, 0.8}, {267, 0.9}, {2107, 0.95}, {66667, 0.99}, {666667, 1}
+};
+
+#define NUM_BUCKETS 4
+static const uint64_t bucket_limits[NUM_BUCKETS] = {10000, 100000, 1000000, UINT64_MAX};
+static const char *bucket_names[NUM_BUCKETS] = {"<10KB", "10KB-100KB", "100KB-1MB", ">1MB"};
+
+static cdf_point *cdf = NULL;
+static size_t cdf_len = 0;
+static int num_flows = 1000;
+static double flow_rate = 100;
+static int flows_started = 0;
+static int flows_completed = 0;
+static quicly_conn_t *workload_conn = NULL;
+static transfer_params flow_params;
+static ev_timer arrival_timer;
+static sample_set fcts_us[NUM_BUCKETS];
+static bool summary_printed = false;
+
+static bool load_builtin(const cdf_point *points, size_t len)
+{
+    cdf = malloc(len * sizeof(cdf_point));
+    assert(cdf != NULL);
+    for(size_t i = 0; i < len; ++i) {
+        cdf[i].bytes = points[i].bytes * 1460;
+        cdf[i].cdf = points[i].cdf;
+    }
+    cdf_len = len;
+    return true;
+}
+
+static bool load_file(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if(f == NULL) {
+        perror("failed to open workload file");
+        return false;
+    }
+
+    double bytes, p;
+    size_t capacity = 0;
+    while(fscanf(f, "%lf %lf", &bytes, &p) == 2) {
+        if(cdf_len == capacity) {
+            capacity = capacity == 0 ? 16 : capacity * 2;
+            cdf = realloc(cdf, capacity * sizeof(cdf_point));
+            assert(cdf != NULL);
+        }
+        if(p < 0 || p > 1 || (cdf_len > 0 && (p < cdf[cdf_len - 1].cdf || bytes < cdf[cdf_len - 1].bytes))) {
+            fprintf(stderr, "workload file must contain increasing \"bytes cdf\" pairs\n");
+            fclose(f);
+            return false;
+        }
+        cdf[cdf_len].bytes = bytes;
+        cdf[cdf_len].cdf = p;
+        ++cdf_len;
+    }
+    fclose(f);
+
+    if(cdf_len == 0 || cdf[cdf_len - 1].cdf != 1) {
+        fprintf(stderr, "workload cdf must end at 1\n");
+        return false;
+    }
+    return true;
+}
+
+bool client_workload_load(const char *name)
+{
+    if(strcmp(name, "websearch") == 0) {
+        return load_builtin(websearch_cdf, PTLS_ELEMENTSOF(websearch_cdf));
+    } else if(strcmp(name, "datamining") == 0) {
+        return load_builtin(datamining_cdf, PTLS_ELEMENTSOF(datamining_cdf));
+    }
+    return load_file(name);
+}
+
+void client_workload_set_flows(int flows, double flows_per_second)
+{
+    num_flows = flows;
+    flow_rate = flows_per_second;
+}
+
+bool client_workload_enabled()
+{
+    return cdf != NULL;
+}
+
+static uint64_t draw_flow_size()
+{
+    if(cdf_len == 1) {
+        return max_int64(cdf[0].bytes, 1);
+    }
+
+    double u = drand48();
+    size_t i = 1;
+    while(i < cdf_len - 1 && cdf[i].cdf < u) {
+        ++i;
+    }
+
+    // linear interpolation between the two surrounding points
+    const cdf_point *lo = &cdf[i - 1], *hi = &cdf[i];
+    double bytes = hi->bytes;
+    if(hi->cdf > lo->cdf) {
+        bytes = lo->bytes + (u - lo->cdf) / (hi->cdf - lo->cdf) * (hi->bytes - lo->bytes);
+    }
+    return max_int64(bytes, 1);
+}
+
+static void arrival_timer_cb(EV_P_ ev_timer *w, int revents)
+{
+    transfer_params params = flow_params;
+    params.bytes = draw_flow_size();
+    client_open_transfer(workload_conn, &params);
+    ++flows_started;
+    client_send_pending();
+
+    // poisson arrivals
+    if(flows_started < num_flows) {
+        ev_timer_set(&arrival_timer, -log(1 - drand48()) / flow_rate, 0);
+        ev_timer_start(EV_A_ &arrival_timer);
+    }
+}
+
+void client_workload_start(quicly_conn_t *conn, const transfer_params *base)
+{
+    workload_conn = conn;
+    flow_params = *base;
+    flow_params.upload = false;
+    flow_params.duration_s = 0;
+    srand48(get_time_us());
+    ev_timer_init(&arrival_timer, arrival_timer_cb, 0, 0);
+    ev_timer_start(EV_DEFAULT, &arrival_timer);
+}
+
+void client_workload_on_flow_complete(uint64_t bytes, int64_t fct_us)
+{
+    size_t bucket = 0;
+    while(bytes > bucket_limits[bucket]) {
+        ++bucket;
+    }
+    sample_set_add(&fcts_us[bucket], fct_us);
+
+    if(++flows_completed == num_flows) {
+        quit_client();
+    }
+}
+
+void client_workload_print_summary()
+{
+    if(!client_workload_enabled() || summary_printed) {
+        return;
+    }
+    summary_printed = true;
+    ev_timer_stop(EV_DEFAULT, &arrival_timer);
+
+    printf("workload: %i of %i flows completed\n", flows_completed, num_flows);
+    for(size_t i = 0; i < NUM_BUCKETS; ++i) {
+        sample_set *fcts = &fcts_us[i];
+        if(fcts->num_values == 0) {
+            printf("flows %s: none\n", bucket_names[i]);
+            continue;
+        }
+        sample_set_sort(fcts);
+        printf("flows %s: %zu flows fct p50 %.3fms p90 %.3fms p99 %.3fms max %.3fms\n",
+               bucket_names[i], fcts->num_values,
+               sample_set_percentile(fcts, 50) / 1000.,
+               sample_set_percentile(fcts, 90) / 1000.,
+               sample_set_percentile(fcts, 99) / 1000.,
+               sample_set_percentile(fcts, 100) / 1000.);
+    }
+    fflush(stdout);
+}
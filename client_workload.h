@@ -0,0 +1,16 @@
+#pragma once
+
+#include "common.h"
+
+#include <quicly.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* name is "websearch", "datamining" or a file with "size-in-bytes cdf" lines */
+bool client_workload_load(const char *name);
+void client_workload_set_flows(int num_flows, double flows_per_second);
+bool client_workload_enabled();
+/* flows use the payload settings of base */
+void client_workload_start(quicly_conn_t *conn, const transfer_params *base);
+void client_workload_on_flow_complete(uint64_t bytes, int64_t fct_us);
+void client_workload_print_summary();
@@ -1,11 +1,21 @@
 #include "common.h"
+#include "trace.h"
 
 #include <sys/socket.h>
 #include <netinet/udp.h>
 #include <netdb.h>
 #include <memory.h>
 #include <picotls/openssl.h>
+#include <quicly/defaults.h>
 #include <errno.h>
+#include <inttypes.h>
+
+#ifdef __linux__
+    #include <linux/errqueue.h>
+    #ifndef SO_RXQ_OVFL
+        #define SO_RXQ_OVFL 40
+    #endif
+#endif
 
 ptls_context_t *get_tlsctx()
 {
@@ -40,13 +50,88 @@ struct addrinfo *get_address(const char *host, const char *port)
     }
 }
 
-bool send_dgrams_default(int fd, struct sockaddr *dest, struct iovec *dgrams, size_t num_dgrams)
+int create_client_socket(int family)
+{
+    int fd = socket(family, SOCK_DGRAM, IPPROTO_UDP);
+    if (fd == -1) {
+        perror("socket(2) failed");
+        return -1;
+    }
+
+    struct sockaddr_storage local;
+    memset(&local, 0, sizeof(local));
+    if (family == AF_INET) {
+        struct sockaddr_in *sin = (struct sockaddr_in *)&local;
+        sin->sin_family = AF_INET;
+        sin->sin_addr.s_addr = INADDR_ANY;
+        sin->sin_port = 0; // Let the OS choose the port
+    } else if (family == AF_INET6) {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&local;
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_addr = in6addr_any;
+        sin6->sin6_port = 0; // Let the OS choose the port
+    } else {
+        fprintf(stderr, "Unknown address family\n");
+        close(fd);
+        return -1;
+    }
+
+    if (bind(fd, (struct sockaddr *)&local, quicly_get_socklen((struct sockaddr *)&local)) != 0) {
+        perror("bind(2) failed");
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+quicly_cid_encryptor_t *new_cid_encryptor()
+{
+    // CIDs only need to be stable for the lifetime of the process
+    uint8_t key[PTLS_SHA256_DIGEST_SIZE];
+    ptls_openssl_random_bytes(key, sizeof(key));
+    return quicly_new_default_cid_encryptor(&ptls_openssl_aes128ecb, &ptls_openssl_aes128ecb, &ptls_openssl_sha256,
+                                            ptls_iovec_init(key, sizeof(key)));
+}
+
+static size_t add_cmsg(void *control, size_t used, int level, int type, const void *data, size_t len)
+{
+    struct cmsghdr *hdr = (struct cmsghdr *)((uint8_t *)control + used);
+    hdr->cmsg_level = level;
+    hdr->cmsg_type = type;
+    hdr->cmsg_len = CMSG_LEN(len);
+    memcpy(CMSG_DATA(hdr), data, len);
+    return used + CMSG_SPACE(len);
+}
+
+static size_t add_ecn_cmsg(void *control, size_t used, struct sockaddr *dest, uint8_t ecn)
+{
+    if(ecn == 0) {
+        return used;
+    }
+    int tos = ecn;
+    if(dest->sa_family == AF_INET) {
+        return add_cmsg(control, used, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+    } else {
+        return add_cmsg(control, used, IPPROTO_IPV6, IPV6_TCLASS, &tos, sizeof(tos));
+    }
+}
+
+bool send_dgrams_default(int fd, struct sockaddr *dest, struct iovec *dgrams, size_t num_dgrams, uint8_t ecn)
 {
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } cmsg;
+    size_t cmsg_len = add_ecn_cmsg(&cmsg, 0, dest, ecn);
+
     for(size_t i = 0; i < num_dgrams; ++i) {
         struct msghdr mess = {
             .msg_name = dest,
             .msg_namelen = quicly_get_socklen(dest),
-            .msg_iov = &dgrams[i], .msg_iovlen = 1
+            .msg_iov = &dgrams[i], .msg_iovlen = 1,
+            .msg_control = cmsg_len != 0 ? &cmsg : NULL,
+            .msg_controllen = cmsg_len
         };
 
         ssize_t bytes_sent;
@@ -66,7 +151,7 @@ bool send_dgrams_default(int fd, struct sockaddr *dest, struct iovec *dgrams, si
         #define UDP_SEGMENT 103 /* Set GSO segmentation size */
     #endif
 
-bool send_dgrams_gso(int fd, struct sockaddr *dest, struct iovec *dgrams, size_t num_dgrams)
+bool send_dgrams_gso(int fd, struct sockaddr *dest, struct iovec *dgrams, size_t num_dgrams, uint8_t ecn)
 {
     struct iovec vec = {
         .iov_base = (void *)dgrams[0].iov_base,
@@ -82,15 +167,17 @@ bool send_dgrams_gso(int fd, struct sockaddr *dest, struct iovec *dgrams, size_t
 
     union {
         struct cmsghdr hdr;
-        char buf[CMSG_SPACE(sizeof(uint16_t))];
+        char buf[CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(int))];
     } cmsg;
+    size_t cmsg_len = 0;
     if (num_dgrams != 1) {
-        cmsg.hdr.cmsg_level = SOL_UDP;
-        cmsg.hdr.cmsg_type = UDP_SEGMENT;
-        cmsg.hdr.cmsg_len = CMSG_LEN(sizeof(uint16_t));
-        *(uint16_t *)CMSG_DATA(&cmsg.hdr) = dgrams[0].iov_len;
+        uint16_t segment_size = dgrams[0].iov_len;
+        cmsg_len = add_cmsg(&cmsg, cmsg_len, SOL_UDP, UDP_SEGMENT, &segment_size, sizeof(segment_size));
+    }
+    cmsg_len = add_ecn_cmsg(&cmsg, cmsg_len, dest, ecn);
+    if (cmsg_len != 0) {
         mess.msg_control = &cmsg;
-        mess.msg_controllen = (socklen_t)CMSG_SPACE(sizeof(uint16_t));
+        mess.msg_controllen = cmsg_len;
     }
 
     ssize_t bytes_sent;
@@ -105,43 +192,114 @@ bool send_dgrams_gso(int fd, struct sockaddr *dest, struct iovec *dgrams, size_t
 
 #endif
 
-bool (*send_dgrams)(int fd, struct sockaddr *dest, struct iovec *dgrams, size_t num_dgrams) = send_dgrams_default;
+bool (*send_dgrams)(int fd, struct sockaddr *dest, struct iovec *dgrams, size_t num_dgrams, uint8_t ecn) = send_dgrams_default;
 
 void enable_gso()
 {
     send_dgrams = send_dgrams_gso;
 }
 
-bool send_pending(quicly_context_t *ctx, int fd, quicly_conn_t *conn)
+static size_t send_batch_size = 16;
+
+void set_send_batch_size(size_t size)
 {
-    #define SEND_BATCH_SIZE 16
+    send_batch_size = size;
+}
 
+int send_batch(quicly_context_t *ctx, int fd, quicly_conn_t *conn)
+{
     quicly_address_t dest, src;
-    struct iovec dgrams[SEND_BATCH_SIZE];
-    uint8_t dgrams_buf[PTLS_ELEMENTSOF(dgrams) * ctx->transport_params.max_udp_payload_size];
-    size_t num_dgrams = SEND_BATCH_SIZE;
-    size_t send_dgrams_c = 0;
-
-    while(true) {
-        num_dgrams = PTLS_ELEMENTSOF(dgrams);
-        int quicly_res = quicly_send(conn, &dest, &src, dgrams, &num_dgrams, &dgrams_buf, sizeof(dgrams_buf));
+    struct iovec dgrams[MAX_SEND_BATCH_SIZE];
+    uint8_t dgrams_buf[send_batch_size * ctx->transport_params.max_udp_payload_size];
+    size_t num_dgrams = send_batch_size;
 
+    int quicly_res = quicly_send(conn, &dest, &src, dgrams, &num_dgrams, &dgrams_buf, sizeof(dgrams_buf));
+    if(quicly_res != 0) {
+        if(quicly_res != QUICLY_ERROR_FREE_CONNECTION) {
+            printf("quicly_send failed with code %i\n", quicly_res);
+        } else {
+            printf("connection closed\n");
+        }
+        return -1;
+    } else if(num_dgrams == 0) {
+        return 0;
+    }
 
-        if(quicly_res != 0) {
-            if(quicly_res != QUICLY_ERROR_FREE_CONNECTION) {
-                printf("quicly_send failed with code %i\n", quicly_res);
-            } else {
-                printf("connection closed\n");
-            }
-            return false;
-        } else if(num_dgrams == 0) {
-            return true;
+    if (!send_dgrams(fd, &dest.sa, dgrams, num_dgrams, quicly_send_get_ecn_bits(conn))) {
+        return -1;
+    }
+    if(trace_enabled()) {
+        size_t bytes = 0;
+        for(size_t i = 0; i < num_dgrams; ++i) {
+            bytes += dgrams[i].iov_len;
         }
+        trace_datagrams_sent(conn, num_dgrams, bytes);
+    }
+    return num_dgrams;
+}
 
-        if (!send_dgrams(fd, &dest.sa, dgrams, num_dgrams)) {
-            return false;
+bool send_pending(quicly_context_t *ctx, int fd, quicly_conn_t *conn)
+{
+    while(true) {
+        int num_dgrams = send_batch(ctx, fd, conn);
+        if(num_dgrams <= 0) {
+            return num_dgrams == 0;
         }
+    }
+}
+
+ssize_t receive_dgram(int fd, void *buf, size_t len, struct sockaddr_storage *sa, socklen_t *salen, recv_info *info)
+{
+    struct iovec vec = {.iov_base = buf, .iov_len = len};
+    union {
+        struct cmsghdr hdr;
+        char buf[RECV_CMSG_SIZE];
+    } cmsg;
+
+    struct msghdr mess = {
+        .msg_name = sa,
+        .msg_namelen = *salen,
+        .msg_iov = &vec,
+        .msg_iovlen = 1,
+        .msg_control = &cmsg,
+        .msg_controllen = sizeof(cmsg)
     };
+
+    ssize_t bytes_received = recvmsg(fd, &mess, MSG_DONTWAIT);
+    if(bytes_received == -1) {
+        return -1;
+    }
+    *salen = mess.msg_namelen;
+    read_recv_info(&mess, info);
+    return bytes_received;
+}
+
+void read_recv_info(struct msghdr *mess, recv_info *info)
+{
+    info->kernel_time_ns = 0;
+    info->hw_time_ns = 0;
+    info->has_rxq_drops = false;
+    info->ecn = 0;
+    for(struct cmsghdr *c = CMSG_FIRSTHDR(mess); c != NULL; c = CMSG_NXTHDR(mess, c)) {
+        if(c->cmsg_level == IPPROTO_IP && c->cmsg_type == IP_TOS) {
+            info->ecn = *(uint8_t *)CMSG_DATA(c) & 3;
+        } else if(c->cmsg_level == IPPROTO_IPV6 && c->cmsg_type == IPV6_TCLASS) {
+            int tclass;
+            memcpy(&tclass, CMSG_DATA(c), sizeof(tclass));
+            info->ecn = tclass & 3;
+        }
+        #ifdef __linux__
+            if(c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_TIMESTAMPING) {
+                /* ts[0] is the software timestamp, ts[2] the raw hardware timestamp */
+                struct scm_timestamping *ts = (struct scm_timestamping *)CMSG_DATA(c);
+                info->kernel_time_ns = (int64_t)ts->ts[0].tv_sec * 1000000000 + ts->ts[0].tv_nsec;
+                info->hw_time_ns = (int64_t)ts->ts[2].tv_sec * 1000000000 + ts->ts[2].tv_nsec;
+            } else if(c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL) {
+                info->has_rxq_drops = true;
+                memcpy(&info->rxq_drops, CMSG_DATA(c), sizeof(uint32_t));
+            }
+        #endif
+    }
 }
 
 void print_escaped(const char *src, size_t len)
@@ -164,3 +322,68 @@ void print_escaped(const char *src, size_t len)
     fflush(stdout);
 }
 
+
+size_t get_resident_bytes()
+{
+    size_t resident = 0;
+    #ifdef __linux__
+        FILE *f = fopen("/proc/self/statm", "r");
+        if(f != NULL) {
+            unsigned long size, pages;
+            if(fscanf(f, "%lu %lu", &size, &pages) == 2) {
+                resident = pages * sysconf(_SC_PAGESIZE);
+            }
+            fclose(f);
+        }
+    #endif
+    return resident;
+}
+
+void format_request(char *dst, const transfer_params *params)
+{
+    dst += sprintf(dst, "%s", params->upload ? UPLOAD_REQUEST : DOWNLOAD_REQUEST);
+    if(params->bytes != 0) {
+        dst += sprintf(dst, " bytes=%" PRIu64, params->bytes);
+    }
+    if(params->duration_s != 0) {
+        dst += sprintf(dst, " duration=%i", params->duration_s);
+    }
+    if(params->payload != PAYLOAD_PATTERN) {
+        dst += sprintf(dst, " payload=%s", payload_mode_name(params->payload));
+    }
+    if(params->payload == PAYLOAD_RANDOM) {
+        dst += sprintf(dst, " seed=%" PRIu64, params->seed);
+    }
+    sprintf(dst, "\n");
+}
+
+bool parse_request(const char *src, transfer_params *params)
+{
+    memset(params, 0, sizeof(*params));
+
+    size_t len;
+    if(strncmp(src, DOWNLOAD_REQUEST, strlen(DOWNLOAD_REQUEST)) == 0) {
+        len = strlen(DOWNLOAD_REQUEST);
+    } else if(strncmp(src, UPLOAD_REQUEST, strlen(UPLOAD_REQUEST)) == 0) {
+        len = strlen(UPLOAD_REQUEST);
+        params->upload = true;
+    } else {
+        return false;
+    }
+
+    for(src += len; *src != '\0' && *src != '\n'; ) {
+        int n = 0;
+        char mode[16];
+        if(sscanf(src, " bytes=%" SCNu64 "%n", &params->bytes, &n) == 1 ||
+           sscanf(src, " duration=%i%n", &params->duration_s, &n) == 1 ||
+           sscanf(src, " seed=%" SCNu64 "%n", &params->seed, &n) == 1) {
+            src += n;
+        } else if(sscanf(src, " payload=%15[a-z]%n", mode, &n) == 1 && parse_payload_mode(mode, &params->payload)) {
+            src += n;
+        } else {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -1,17 +1,80 @@
 #pragma once
 
+#include "payload.h"
+
 #include <quicly.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
 #include <sys/syscall.h>
 
+#define PROBE_REQUEST "qperf probe\n"
+
+typedef struct
+{
+    uint64_t seq;
+    int64_t send_time_us;      // wall clock, compared to the server's kernel receive time for one-way delays
+    int64_t send_mono_time_us; // echoed unchanged, the round-trip time must not follow wall clock steps
+    int64_t server_rx_time_us;
+} probe_message;
+
+typedef struct
+{
+    int64_t kernel_time_ns;
+    int64_t hw_time_ns;
+    bool has_rxq_drops;
+    uint32_t rxq_drops;
+    uint8_t ecn;  // ECN bits of the IP header, only received with --ecn
+} recv_info;
+
+#define DOWNLOAD_REQUEST "qperf start sending"
+#define UPLOAD_REQUEST "qperf start receiving"
+
+typedef struct
+{
+    bool upload;
+    uint64_t bytes;   // 0 for unlimited
+    int duration_s;   // 0 for unlimited
+    payload_mode payload;
+    uint64_t seed;    // only used by PAYLOAD_RANDOM
+} transfer_params;
+
+#define DATAGRAM_REQUEST "qperf send datagrams"
+#define DATAGRAM_PAYLOAD_SIZE 1200
+
+typedef struct
+{
+    uint64_t seq;
+    int64_t send_time_us;
+} datagram_header;
+
 ptls_context_t *get_tlsctx();
 
 struct addrinfo *get_address(const char *host, const char *port);
+/* unconnected UDP socket bound to an ephemeral port */
+int create_client_socket(int family);
+quicly_cid_encryptor_t *new_cid_encryptor();
 void enable_gso();
+#define MAX_SEND_BATCH_SIZE 64
+/* datagrams built by one quicly_send call and passed to one send_dgrams call */
+void set_send_batch_size(size_t size);
+/* runs quicly_send once, returns the number of datagrams sent or -1 if the connection is done */
+int send_batch(quicly_context_t *ctx, int fd, quicly_conn_t *conn);
 bool send_pending(quicly_context_t *ctx, int fd, quicly_conn_t *conn);
+ssize_t receive_dgram(int fd, void *buf, size_t len, struct sockaddr_storage *sa, socklen_t *salen, recv_info *info);
+/* control buffer size for receive_dgram's ancillary data, for callers that fill msghdrs themselves */
+#define RECV_CMSG_SIZE (CMSG_SPACE(3 * sizeof(struct timespec)) + CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(int)))
+/* fills info from the ancillary data of a received message */
+void read_recv_info(struct msghdr *mess, recv_info *info);
 void print_escaped(const char *src, size_t len);
+/* resident set size of the process in bytes, 0 if unavailable */
+size_t get_resident_bytes();
+/* request line sent on a transfer stream, terminated by a newline */
+void format_request(char *dst, const transfer_params *params);
+/* accepts both the current request line and the plain request of older clients */
+bool parse_request(const char *src, transfer_params *params);
 
 
 static inline int64_t min_int64(int64_t a, int64_t b)
@@ -42,6 +105,21 @@ static inline int64_t clamp_int64(int64_t val, int64_t min, int64_t max)
     return val;
 }
 
+static inline int64_t get_time_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* same clock as kernel software timestamps */
+static inline int64_t get_wall_time_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 static inline uint64_t get_current_pid()
 {
     uint64_t pid;
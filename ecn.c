@@ -0,0 +1,75 @@
+#include "ecn.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+
+static bool ecn = false;
+
+void enable_ecn()
+{
+    ecn = true;
+}
+
+bool ecn_enabled()
+{
+    return ecn;
+}
+
+void setup_ecn_settings(quicly_context_t *ctx)
+{
+    // quicly marks ECT(0) once the path is validated and reacts to CE marks reported in ACKs
+    ctx->enable_ecn = ecn;
+}
+
+bool setup_ecn(int fd)
+{
+    if(!ecn) {
+        return true;
+    }
+
+    struct sockaddr_storage local;
+    socklen_t len = sizeof(local);
+    if(getsockname(fd, (struct sockaddr *)&local, &len) != 0) {
+        perror("getsockname failed");
+        return false;
+    }
+
+    int on = 1;
+    if(local.ss_family == AF_INET6) {
+        if(setsockopt(fd, IPPROTO_IPV6, IPV6_RECVTCLASS, &on, sizeof(on)) != 0) {
+            fprintf(stderr, "setsockopt(IPV6_RECVTCLASS) failed: %s\n", strerror(errno));
+            return false;
+        }
+        // dual stack sockets receive IPv4 packets with an IP_TOS cmsg, single stack ones may refuse this
+        setsockopt(fd, IPPROTO_IP, IP_RECVTOS, &on, sizeof(on));
+    } else if(setsockopt(fd, IPPROTO_IP, IP_RECVTOS, &on, sizeof(on)) != 0) {
+        fprintf(stderr, "setsockopt(IP_RECVTOS) failed: %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void ecn_report(quicly_conn_t *conn, ecn_counters *last, const char *prefix)
+{
+    quicly_stats_t stats;
+    quicly_get_stats(conn, &stats);
+
+    uint64_t received[QUICLY_NUM_ECN], acked[QUICLY_NUM_ECN];
+    for(int i = 0; i < QUICLY_NUM_ECN; ++i) {
+        received[i] = stats.num_packets.received_ecn_counts[i] - last->received[i];
+        acked[i] = stats.num_packets.acked_ecn_counts[i] - last->acked[i];
+        last->received[i] = stats.num_packets.received_ecn_counts[i];
+        last->acked[i] = stats.num_packets.acked_ecn_counts[i];
+    }
+    uint64_t congestion_events = stats.cc.num_ecn_loss_episodes - last->congestion_events;
+    last->congestion_events = stats.cc.num_ecn_loss_episodes;
+
+    const char *state = stats.num_paths.ecn_failed != 0 ? "failed" : stats.num_paths.ecn_validated != 0 ? "validated" : "testing";
+    printf("%s ecn %s received ect0: %" PRIu64 " ect1: %" PRIu64 " ce: %" PRIu64 " acked ect0: %" PRIu64 " ect1: %" PRIu64
+           " ce: %" PRIu64 " congestion events: %" PRIu64 "\n",
+           prefix, state, received[0], received[1], received[2], acked[0], acked[1], acked[2], congestion_events);
+}
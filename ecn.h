@@ -0,0 +1,20 @@
+#pragma once
+
+#include <quicly.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct
+{
+    uint64_t received[QUICLY_NUM_ECN]; // ECT(0), ECT(1), CE
+    uint64_t acked[QUICLY_NUM_ECN];
+    uint64_t congestion_events;
+} ecn_counters;
+
+void enable_ecn();
+bool ecn_enabled();
+void setup_ecn_settings(quicly_context_t *ctx);
+/* enables receiving the TOS/traffic class byte if ECN is enabled */
+bool setup_ecn(int fd);
+/* prints ECN marks received and acknowledged by the peer since the last report */
+void ecn_report(quicly_conn_t *conn, ecn_counters *last, const char *prefix);
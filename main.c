@@ -5,6 +5,18 @@
 
 #include "server.h"
 #include "client.h"
+#include "client_stream.h"
+#include "client_datagram.h"
+#include "client_workload.h"
+#include "client_idle.h"
+#include "client_migration.h"
+#include "timestamps.h"
+#include "socket_stats.h"
+#include "ack_stats.h"
+#include "ecn.h"
+#include "run_summary.h"
+#include "rx_thread.h"
+#include "trace.h"
 
 
 static void usage(const char *cmd)
@@ -12,15 +24,53 @@ static void usage(const char *cmd)
     printf("Usage: %s [options]\n"
             "\n"
             "Options:\n"
+            "  --ack-frequency f    ask the peer to acknowledge once per fraction f of the congestion window (ACK frequency extension)\n"
+            "  --ack-stats          report ACK frames sent and received per packet every second\n"
+            "  --batch n            datagrams built and sent per batch (default 16, max 64)\n"
+            "  --bytes bytes        transfer exactly this many bytes, then report the completion time (client only)\n"
             "  -c target            run as client and connect to target server\n"
+            "  --cpu n              pin the thread running the client connection to cpu n (client only)\n"
             "  --cc [reno,cubic]    congestion control algorithm to use (default reno)\n"
+            "  --datagram mbit/s    receive unreliable QUIC DATAGRAM frames at a target rate, 0 for as fast as possible (client only)\n"
+            "  --duration time (s)  let the sender stop after X seconds (client only)\n"
+            "  --drops              report kernel socket queue drops and host udp errors every second\n"
+            "  --ecn                mark packets ECT(0), read ECN marks and report them every second\n"
             "  -e                   measure time for connection establishment and first byte only\n"
+            "  --flows count        number of flows for --workload (default 1000)\n"
+            "  --flow-rate flows/s  poisson arrival rate of flows for --workload (default 100)\n"
             "  -g                   enable UDP generic segmentation offload\n"
+            "  --idle-connections n open n mostly idle connections and keep them alive (client only)\n"
+            "  --idle-sockets n     number of sockets shared by --idle-connections (default 16)\n"
             "  --iw initial-window  initial window to use (default 10)\n"
+            "  --keepalive ms       keepalive interval of --idle-connections (default 1000)\n"
+            "  --max-ack-delay ms   max_ack_delay transport parameter to advertise (default 25)\n"
+            "  --metrics address    serve Prometheus metrics over HTTP on [host:]port (default host 127.0.0.1) or a unix\n"
+            "                       socket path (server only)\n"
+            "  --migrate time (s)   move the client to a new local port after X seconds of transfer and report the impact (client only)\n"
+            "  --migrate-interval s repeat --migrate every X seconds\n"
+            "  --omit time (s)      leave the first X seconds out of the summary and run that much longer (client only)\n"
             "  -l log-file          file to log tls secrets\n"
+            "  --rcvbuf bytes       kernel socket receive buffer size\n"
+            "  --repeat n           run n times with a new connection each and print the mean over the runs with its\n"
+            "                       95%% confidence interval (client only)\n"
+            "  --seed n             seed of --payload random (default 0)\n"
+            "  --sndbuf bytes       kernel socket send buffer size\n"
             "  -p                   port to listen on/connect to (default 18080)\n"
+            "  --payload mode       pattern (default), random (seeded, incompressible) or none (buffers are not written) (client only)\n"
+            "  --probe interval-ms  send latency probes on a separate stream, idle and under load (client only)\n"
+            "  --rx-cpu n           pin the --rx-thread to cpu n\n"
+            "  --rx-thread          read the socket on a separate thread that passes packets to the connection through a ring,\n"
+            "                       and report the ring depth every second (client only)\n"
             "  -s  address          listen as server on address\n"
-            "  -t time (s)          run for X seconds (default 10s)\n"
+            "  --steady             detect when the throughput became steady and summarize from there (client only)\n"
+            "  --timestamps         report kernel receive timestamps (inter-arrival, kernel to app latency, one-way delay with --probe)\n"
+            "  -t time (s)          run for X seconds (default 10s), ignored with --workload\n"
+            "  --trace file         write packet, congestion control and stream events to file as qlog (JSON-SEQ)\n"
+            "  --trace-format f     qlog (default) or binary, a compact record per event as defined in trace.h\n"
+            "  --upload             send data from the client to the server instead (client only)\n"
+            "  --verify             check every received byte against the payload, downloads only (client only)\n"
+            "  --workload cdf       run many short flows with sizes from websearch, datamining or a file with\n"
+            "                       \"bytes cdf\" lines and report flow completion times (client only)\n"
             "  -h                   print this help\n"
             "\n",
            cmd);
@@ -30,6 +80,40 @@ static struct option long_options[] =
 {
     {"cc", required_argument, NULL, 0},
     {"iw", required_argument, NULL, 1},
+    {"probe", required_argument, NULL, 2},
+    {"timestamps", no_argument, NULL, 3},
+    {"rcvbuf", required_argument, NULL, 4},
+    {"sndbuf", required_argument, NULL, 5},
+    {"drops", no_argument, NULL, 6},
+    {"datagram", required_argument, NULL, 7},
+    {"bytes", required_argument, NULL, 8},
+    {"duration", required_argument, NULL, 9},
+    {"upload", no_argument, NULL, 10},
+    {"workload", required_argument, NULL, 11},
+    {"flows", required_argument, NULL, 12},
+    {"flow-rate", required_argument, NULL, 13},
+    {"idle-connections", required_argument, NULL, 14},
+    {"idle-sockets", required_argument, NULL, 15},
+    {"keepalive", required_argument, NULL, 16},
+    {"payload", required_argument, NULL, 17},
+    {"seed", required_argument, NULL, 18},
+    {"verify", no_argument, NULL, 19},
+    {"ack-frequency", required_argument, NULL, 20},
+    {"max-ack-delay", required_argument, NULL, 21},
+    {"ack-stats", no_argument, NULL, 22},
+    {"ecn", no_argument, NULL, 23},
+    {"migrate", required_argument, NULL, 24},
+    {"migrate-interval", required_argument, NULL, 25},
+    {"batch", required_argument, NULL, 26},
+    {"omit", required_argument, NULL, 27},
+    {"steady", no_argument, NULL, 28},
+    {"repeat", required_argument, NULL, 29},
+    {"rx-thread", no_argument, NULL, 30},
+    {"rx-cpu", required_argument, NULL, 31},
+    {"cpu", required_argument, NULL, 32},
+    {"trace", required_argument, NULL, 33},
+    {"trace-format", required_argument, NULL, 34},
+    {"metrics", required_argument, NULL, 35},
     {NULL, 0, NULL, 0}
 };
 
@@ -46,6 +130,31 @@ int main(int argc, char** argv)
     const char *logfile = NULL;
     const char *cc = "reno";
     int iw = 10;
+    int probe_interval_ms = 0;
+    int rcvbuf = 0;
+    int sndbuf = 0;
+    bool datagram = false;
+    uint64_t datagram_rate_mbit = 0;
+    transfer_params transfer = {.upload = false, .bytes = 0, .duration_s = 0};
+    const char *workload = NULL;
+    int num_flows = 1000;
+    double flow_rate = 100;
+    int idle_connections = 0;
+    int idle_sockets = 16;
+    int keepalive_ms = 1000;
+    bool payload_set = false;
+    bool verify = false;
+    int migrate_s = 0;
+    int migrate_interval_s = 0;
+    int omit_s = 0;
+    bool steady = false;
+    int repeat = 1;
+    bool rx_thread = false;
+    int rx_cpu = -1;
+    int cpu = -1;
+    const char *trace_file = NULL;
+    bool trace_binary = false;
+    const char *metrics_address = NULL;
 
     while ((ch = getopt_long(argc, argv, "c:egl:p:s:t:h", long_options, NULL)) != -1) {
         switch (ch) {
@@ -63,6 +172,194 @@ int main(int argc, char** argv)
                 exit(1);
             }
             break;
+        case 2:
+            if(sscanf(optarg, "%u", &probe_interval_ms) != 1 || probe_interval_ms < 1) {
+                fprintf(stderr, "invalid argument passed to --probe\n");
+                exit(1);
+            }
+            break;
+        case 3:
+            #ifdef __linux__
+                enable_rx_timestamps();
+            #else
+                fprintf(stderr, "kernel timestamps only supported on linux\n");
+                exit(1);
+            #endif
+            break;
+        case 4:
+            if(sscanf(optarg, "%u", &rcvbuf) != 1 || rcvbuf < 1) {
+                fprintf(stderr, "invalid argument passed to --rcvbuf\n");
+                exit(1);
+            }
+            break;
+        case 5:
+            if(sscanf(optarg, "%u", &sndbuf) != 1 || sndbuf < 1) {
+                fprintf(stderr, "invalid argument passed to --sndbuf\n");
+                exit(1);
+            }
+            break;
+        case 6:
+            enable_drop_stats();
+            break;
+        case 7:
+            if(sscanf(optarg, "%" SCNu64, &datagram_rate_mbit) != 1) {
+                fprintf(stderr, "invalid argument passed to --datagram\n");
+                exit(1);
+            }
+            datagram = true;
+            break;
+        case 8:
+            if(sscanf(optarg, "%" SCNu64, &transfer.bytes) != 1 || transfer.bytes == 0) {
+                fprintf(stderr, "invalid argument passed to --bytes\n");
+                exit(1);
+            }
+            break;
+        case 9:
+            if(sscanf(optarg, "%u", &transfer.duration_s) != 1 || transfer.duration_s < 1) {
+                fprintf(stderr, "invalid argument passed to --duration\n");
+                exit(1);
+            }
+            break;
+        case 10:
+            transfer.upload = true;
+            break;
+        case 11:
+            workload = optarg;
+            break;
+        case 12:
+            if(sscanf(optarg, "%u", &num_flows) != 1 || num_flows < 1) {
+                fprintf(stderr, "invalid argument passed to --flows\n");
+                exit(1);
+            }
+            break;
+        case 13:
+            if(sscanf(optarg, "%lf", &flow_rate) != 1 || flow_rate <= 0) {
+                fprintf(stderr, "invalid argument passed to --flow-rate\n");
+                exit(1);
+            }
+            break;
+        case 14:
+            if(sscanf(optarg, "%u", &idle_connections) != 1 || idle_connections < 1) {
+                fprintf(stderr, "invalid argument passed to --idle-connections\n");
+                exit(1);
+            }
+            break;
+        case 15:
+            if(sscanf(optarg, "%u", &idle_sockets) != 1 || idle_sockets < 1) {
+                fprintf(stderr, "invalid argument passed to --idle-sockets\n");
+                exit(1);
+            }
+            break;
+        case 16:
+            if(sscanf(optarg, "%u", &keepalive_ms) != 1 || keepalive_ms < 1) {
+                fprintf(stderr, "invalid argument passed to --keepalive\n");
+                exit(1);
+            }
+            break;
+        case 17:
+            if(!parse_payload_mode(optarg, &transfer.payload)) {
+                fprintf(stderr, "invalid argument passed to --payload\n");
+                exit(1);
+            }
+            payload_set = true;
+            break;
+        case 18:
+            if(sscanf(optarg, "%" SCNu64, &transfer.seed) != 1) {
+                fprintf(stderr, "invalid argument passed to --seed\n");
+                exit(1);
+            }
+            break;
+        case 19:
+            verify = true;
+            break;
+        case 20: {
+            double fraction;
+            if(sscanf(optarg, "%lf", &fraction) != 1 || fraction <= 0 || fraction > 1) {
+                fprintf(stderr, "invalid argument passed to --ack-frequency\n");
+                exit(1);
+            }
+            set_ack_frequency(fraction);
+            break;
+        }
+        case 21: {
+            int max_ack_delay;
+            if(sscanf(optarg, "%u", &max_ack_delay) != 1 || max_ack_delay < 1 || max_ack_delay >= 1 << 14) {
+                fprintf(stderr, "invalid argument passed to --max-ack-delay\n");
+                exit(1);
+            }
+            set_max_ack_delay(max_ack_delay);
+            break;
+        }
+        case 22:
+            enable_ack_stats();
+            break;
+        case 23:
+            enable_ecn();
+            break;
+        case 24:
+            if(sscanf(optarg, "%u", &migrate_s) != 1 || migrate_s < 1) {
+                fprintf(stderr, "invalid argument passed to --migrate\n");
+                exit(1);
+            }
+            break;
+        case 25:
+            if(sscanf(optarg, "%u", &migrate_interval_s) != 1 || migrate_interval_s < 1) {
+                fprintf(stderr, "invalid argument passed to --migrate-interval\n");
+                exit(1);
+            }
+            break;
+        case 26: {
+            int batch;
+            if(sscanf(optarg, "%u", &batch) != 1 || batch < 1 || batch > MAX_SEND_BATCH_SIZE) {
+                fprintf(stderr, "invalid argument passed to --batch\n");
+                exit(1);
+            }
+            set_send_batch_size(batch);
+            break;
+        }
+        case 27:
+            if(sscanf(optarg, "%u", &omit_s) != 1 || omit_s < 1) {
+                fprintf(stderr, "invalid argument passed to --omit\n");
+                exit(1);
+            }
+            break;
+        case 28:
+            steady = true;
+            break;
+        case 29:
+            if(sscanf(optarg, "%u", &repeat) != 1 || repeat < 1) {
+                fprintf(stderr, "invalid argument passed to --repeat\n");
+                exit(1);
+            }
+            break;
+        case 30:
+            rx_thread = true;
+            break;
+        case 31:
+            if(sscanf(optarg, "%u", &rx_cpu) != 1 || rx_cpu < 0) {
+                fprintf(stderr, "invalid argument passed to --rx-cpu\n");
+                exit(1);
+            }
+            break;
+        case 32:
+            if(sscanf(optarg, "%u", &cpu) != 1 || cpu < 0) {
+                fprintf(stderr, "invalid argument passed to --cpu\n");
+                exit(1);
+            }
+            break;
+        case 33:
+            trace_file = optarg;
+            break;
+        case 34:
+            if(strcmp(optarg, "qlog") != 0 && strcmp(optarg, "binary") != 0) {
+                fprintf(stderr, "invalid argument passed to --trace-format\n");
+                exit(1);
+            }
+            trace_binary = strcmp(optarg, "binary") == 0;
+            break;
+        case 35:
+            metrics_address = optarg;
+            break;
         case 'c':
             host = optarg;
             break;
@@ -114,9 +411,126 @@ int main(int argc, char** argv)
     }
 
 
+    if(server_mode && probe_interval_ms > 0) {
+        printf("cannot use --probe in server mode\n");
+        exit(1);
+    }
+
+    if(server_mode && datagram) {
+        printf("cannot use --datagram in server mode\n");
+        exit(1);
+    }
+
+    if(server_mode && (transfer.upload || transfer.bytes != 0 || transfer.duration_s != 0 || workload != NULL)) {
+        printf("cannot use --bytes, --duration, --upload or --workload in server mode\n");
+        exit(1);
+    }
+
+    if(datagram && (transfer.upload || transfer.bytes != 0 || transfer.duration_s != 0 || workload != NULL)) {
+        printf("cannot use --datagram with --bytes, --duration, --upload or --workload\n");
+        exit(1);
+    }
+
+    if(server_mode && (payload_set || verify)) {
+        printf("cannot use --payload or --verify in server mode\n");
+        exit(1);
+    }
+
+    if(verify && (transfer.upload || transfer.payload == PAYLOAD_NONE)) {
+        printf("cannot use --verify with --upload or --payload none\n");
+        exit(1);
+    }
+
+    if(workload != NULL) {
+        if(!client_workload_load(workload)) {
+            exit(1);
+        }
+        client_workload_set_flows(num_flows, flow_rate);
+    }
+
+    if(server_mode && migrate_s > 0) {
+        printf("cannot use --migrate in server mode\n");
+        exit(1);
+    }
+
+    if(migrate_interval_s > 0 && migrate_s == 0) {
+        printf("--migrate-interval requires --migrate\n");
+        exit(1);
+    }
+
+    if(server_mode && idle_connections > 0) {
+        printf("cannot use --idle-connections in server mode\n");
+        exit(1);
+    }
+
+    if(server_mode && (omit_s > 0 || steady || repeat > 1)) {
+        printf("cannot use --omit, --steady or --repeat in server mode\n");
+        exit(1);
+    }
+
+    if(idle_connections > 0 && (omit_s > 0 || steady || repeat > 1)) {
+        printf("cannot use --omit, --steady or --repeat with --idle-connections\n");
+        exit(1);
+    }
+
+    // the runs of --repeat are forked children, which would share one trace file without a writer thread
+    if(trace_file != NULL && repeat > 1) {
+        printf("cannot use --trace with --repeat\n");
+        exit(1);
+    }
+
+    if(!server_mode && metrics_address != NULL) {
+        printf("--metrics is only supported in server mode\n");
+        exit(1);
+    }
+
+    if(server_mode && (rx_thread || cpu != -1)) {
+        printf("cannot use --rx-thread or --cpu in server mode\n");
+        exit(1);
+    }
+
+    if(rx_cpu != -1 && !rx_thread) {
+        printf("--rx-cpu requires --rx-thread\n");
+        exit(1);
+    }
+
+    if(rx_thread && (migrate_s > 0 || idle_connections > 0)) {
+        printf("cannot use --rx-thread with --migrate or --idle-connections\n");
+        exit(1);
+    }
+
+    client_set_transfer(&transfer);
+    client_idle_configure(idle_connections, idle_sockets, keepalive_ms);
+    client_set_probe_interval(probe_interval_ms);
+    client_set_migration(migrate_s, migrate_interval_s);
+    client_set_cpu(cpu);
+    if(rx_thread) {
+        enable_rx_thread();
+        set_rx_thread_cpu(rx_cpu);
+    }
+    if(verify) {
+        client_enable_verify();
+    }
+    if(datagram) {
+        client_enable_datagrams(datagram_rate_mbit * 1000000 / 8);
+    }
+    set_socket_buffer_sizes(rcvbuf, sndbuf);
+    set_omit_seconds(omit_s);
+    if(steady) {
+        enable_steady_state_detection();
+    }
+
+    if(trace_file != NULL && !trace_open(trace_file, trace_binary, server_mode ? "server" : "client")) {
+        exit(1);
+    }
+
     char port_char[16];
     sprintf(port_char, "%d", port);
-    return server_mode ?
-                run_server(address, port_char, gso, logfile, cc, iw, "server.crt", "server.key") :
+    if(server_mode) {
+        server_set_metrics_address(metrics_address);
+        return run_server(address, port_char, gso, logfile, cc, iw, "server.crt", "server.key");
+    }
+    return repeat > 1 ?
+                run_client_repeated(repeat, port_char, gso, logfile, cc, iw, host, runtime_s, ttfb_only) :
                 run_client(port_char, gso, logfile, cc, iw, host, runtime_s, ttfb_only);
 }
\ No newline at end of file
@@ -0,0 +1,205 @@
+#include "metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* requests are a single GET line and a few headers, anything longer is rejected */
+#define MAX_REQUEST_SIZE 4096
+
+typedef struct
+{
+    ev_io watcher;
+    char request[MAX_REQUEST_SIZE];
+    size_t request_len;
+    char *response;
+    size_t response_len;
+    size_t sent;
+} metrics_client;
+
+static struct ev_loop *metrics_loop;
+static ev_io listen_watcher;
+static void (*write_metrics_cb)(FILE *out);
+
+static void close_client(metrics_client *c)
+{
+    ev_io_stop(metrics_loop, &c->watcher);
+    close(c->watcher.fd);
+    free(c->response);
+    free(c);
+}
+
+static void client_write_cb(EV_P_ ev_io *w, int revents)
+{
+    metrics_client *c = (metrics_client *)w;
+    while(c->sent < c->response_len) {
+        ssize_t n = send(w->fd, c->response + c->sent, c->response_len - c->sent, MSG_NOSIGNAL);
+        if(n == -1) {
+            if(errno == EWOULDBLOCK || errno == EAGAIN) {
+                return;
+            }
+            break;
+        }
+        c->sent += n;
+    }
+    close_client(c);
+}
+
+static void build_response(metrics_client *c)
+{
+    FILE *out = open_memstream(&c->response, &c->response_len);
+    if(strncmp(c->request, "GET /metrics ", 13) == 0 || strncmp(c->request, "GET / ", 6) == 0) {
+        char *body;
+        size_t body_len;
+        FILE *body_out = open_memstream(&body, &body_len);
+        write_metrics_cb(body_out);
+        fclose(body_out);
+        fprintf(out, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                body_len);
+        fwrite(body, 1, body_len, out);
+        free(body);
+    } else {
+        fprintf(out, "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+    }
+    fclose(out);
+}
+
+static void client_read_cb(EV_P_ ev_io *w, int revents)
+{
+    metrics_client *c = (metrics_client *)w;
+    ssize_t n = recv(w->fd, c->request + c->request_len, sizeof(c->request) - 1 - c->request_len, 0);
+    if(n == -1 && (errno == EWOULDBLOCK || errno == EAGAIN)) {
+        return;
+    }
+    if(n <= 0) {
+        close_client(c);
+        return;
+    }
+    c->request_len += n;
+    c->request[c->request_len] = '\0';
+
+    if(strstr(c->request, "\r\n\r\n") == NULL && strstr(c->request, "\n\n") == NULL) {
+        if(c->request_len == sizeof(c->request) - 1) {
+            close_client(c);
+        }
+        return;
+    }
+
+    // the body is generated at once, the socket is then only written until the response is out
+    build_response(c);
+    ev_io_stop(EV_A_ w);
+    ev_io_init(w, &client_write_cb, w->fd, EV_WRITE);
+    ev_io_start(EV_A_ w);
+}
+
+static void accept_cb(EV_P_ ev_io *w, int revents)
+{
+    int fd;
+    while((fd = accept(w->fd, NULL, NULL)) != -1) {
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        metrics_client *c = calloc(1, sizeof(metrics_client));
+        if(c == NULL) {
+            close(fd);
+            continue;
+        }
+        ev_io_init(&c->watcher, &client_read_cb, fd, EV_READ);
+        ev_io_start(EV_A_ &c->watcher);
+    }
+}
+
+static int listen_unix(const char *path)
+{
+    struct sockaddr_un sa = {.sun_family = AF_UNIX};
+    if(strlen(path) >= sizeof(sa.sun_path)) {
+        fprintf(stderr, "metrics socket path too long\n");
+        return -1;
+    }
+    strcpy(sa.sun_path, path);
+    unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == -1 || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+        perror("binding metrics socket failed");
+        if(fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+static int listen_tcp(const char *address)
+{
+    char host[256] = "127.0.0.1";
+    const char *port = address;
+    const char *colon = strrchr(address, ':');
+    if(colon != NULL) {
+        // [::1]:9090 or 0.0.0.0:9090
+        size_t len = colon - address;
+        if(len >= 2 && address[0] == '[' && address[len - 1] == ']') {
+            ++address;
+            len -= 2;
+        }
+        if(len >= sizeof(host)) {
+            fprintf(stderr, "invalid metrics address\n");
+            return -1;
+        }
+        memcpy(host, address, len);
+        host[len] = '\0';
+        port = colon + 1;
+    }
+
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_NUMERICSERV | AI_PASSIVE};
+    struct addrinfo *result;
+    int ret = getaddrinfo(host, port, &hints, &result);
+    if(ret != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(ret));
+        return -1;
+    }
+
+    int fd = -1;
+    for(const struct addrinfo *rp = result; rp != NULL; rp = rp->ai_next) {
+        fd = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if(fd == -1) {
+            continue;
+        }
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if(bind(fd, rp->ai_addr, rp->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+    if(fd == -1) {
+        perror("binding metrics socket failed");
+    }
+    return fd;
+}
+
+bool metrics_listen(struct ev_loop *loop, const char *address, void (*write_metrics)(FILE *out))
+{
+    int fd = address[0] == '/' ? listen_unix(address) : listen_tcp(address);
+    if(fd == -1) {
+        return false;
+    }
+    if(listen(fd, 16) != 0) {
+        perror("listen failed");
+        close(fd);
+        return false;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+
+    metrics_loop = loop;
+    write_metrics_cb = write_metrics;
+    ev_io_init(&listen_watcher, &accept_cb, fd, EV_READ);
+    ev_io_start(loop, &listen_watcher);
+    printf("serving metrics on %s\n", address);
+    return true;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <ev.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/* serves Prometheus text format over HTTP on [host:]port (default host 127.0.0.1) or on a unix socket for paths
+ * starting with '/', write_metrics is only called when a scrape arrives */
+bool metrics_listen(struct ev_loop *loop, const char *address, void (*write_metrics)(FILE *out));
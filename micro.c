@@ -0,0 +1,428 @@
+#include "common.h"
+#include "payload.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <quicly.h>
+#include <quicly/defaults.h>
+#include <quicly/streambuf.h>
+#include <picotls/openssl.h>
+
+#include <picotls/../../t/util.h>
+
+/* packets a queue holds, like a socket buffer; senders stop when it is full so nothing is lost */
+#define QUEUE_CAPACITY 1024
+
+typedef struct
+{
+    uint8_t *slots;
+    size_t slot_size;
+    size_t lens[QUEUE_CAPACITY];
+    size_t head;
+    size_t count;
+} packet_queue;
+
+typedef struct
+{
+    uint64_t packets;
+    int64_t ns;
+    // quicly_send calls that had nothing to send, kept apart so they do not inflate the time per packet
+    uint64_t empty_calls;
+    int64_t empty_ns;
+} phase;
+
+typedef struct
+{
+    phase data_send;    // server quicly_send
+    phase data_receive; // client quicly_decode_packet + quicly_receive
+    phase ack_send;     // client quicly_send
+    phase ack_receive;  // server quicly_decode_packet + quicly_receive
+    uint64_t bytes;
+} counters;
+
+static quicly_context_t client_ctx, server_ctx;
+static ptls_context_t server_tls;
+static quicly_cid_plaintext_t next_cid;
+static size_t batch_size = 16;
+static payload_mode payload = PAYLOAD_PATTERN;
+static counters report, total;
+static bool measuring = false;
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void queue_init(packet_queue *q, size_t slot_size)
+{
+    q->slots = malloc(QUEUE_CAPACITY * slot_size);
+    q->slot_size = slot_size;
+    q->head = 0;
+    q->count = 0;
+}
+
+static void queue_push(packet_queue *q, const struct iovec *dgram)
+{
+    size_t tail = (q->head + q->count) % QUEUE_CAPACITY;
+    memcpy(q->slots + tail * q->slot_size, dgram->iov_base, dgram->iov_len);
+    q->lens[tail] = dgram->iov_len;
+    ++q->count;
+}
+
+static void add_phase(phase *p, uint64_t packets, int64_t ns)
+{
+    if(!measuring) {
+        return;
+    }
+    if(packets > 0) {
+        p->packets += packets;
+        p->ns += ns;
+    } else {
+        ++p->empty_calls;
+        p->empty_ns += ns;
+    }
+}
+
+/* as send_pending, but into a queue instead of a socket */
+static bool send_into(quicly_conn_t *conn, packet_queue *q, phase *p)
+{
+    quicly_context_t *ctx = quicly_get_context(conn);
+    while(QUEUE_CAPACITY - q->count >= batch_size) {
+        quicly_address_t dest, src;
+        struct iovec dgrams[MAX_SEND_BATCH_SIZE];
+        uint8_t buf[batch_size * ctx->transport_params.max_udp_payload_size];
+        size_t num_dgrams = batch_size;
+
+        int64_t start = now_ns();
+        quicly_error_t ret = quicly_send(conn, &dest, &src, dgrams, &num_dgrams, buf, sizeof(buf));
+        add_phase(p, num_dgrams, now_ns() - start);
+        if(ret != 0) {
+            fprintf(stderr, "quicly_send failed with code %li\n", ret);
+            return false;
+        }
+
+        for(size_t i = 0; i < num_dgrams; ++i) {
+            queue_push(q, &dgrams[i]);
+        }
+        if(num_dgrams < batch_size) {
+            break;
+        }
+    }
+    return true;
+}
+
+/* hands all queued packets to conn, accepting a new connection if *conn is NULL */
+static bool receive_from(quicly_context_t *ctx, quicly_conn_t **conn, packet_queue *q, struct sockaddr *peer, phase *p)
+{
+    if(q->count == 0) {
+        return true;
+    }
+    int64_t start = now_ns();
+    uint64_t num_packets = q->count;
+    for(; q->count > 0; q->head = (q->head + 1) % QUEUE_CAPACITY, --q->count) {
+        uint8_t *data = q->slots + q->head * q->slot_size;
+        size_t len = q->lens[q->head];
+        for(size_t offset = 0; offset < len; ) {
+            quicly_decoded_packet_t packet;
+            if(quicly_decode_packet(ctx, &packet, data, len, &offset) == SIZE_MAX) {
+                break;
+            }
+            quicly_error_t ret;
+            if(*conn == NULL) {
+                ret = quicly_accept(conn, ctx, NULL, peer, &packet, NULL, &next_cid, NULL, NULL);
+                ++next_cid.master_id;
+            } else {
+                ret = quicly_receive(*conn, NULL, peer, &packet);
+            }
+            if(ret != 0 && ret != QUICLY_ERROR_PACKET_IGNORED) {
+                fprintf(stderr, "quicly_receive returned %li\n", ret);
+                return false;
+            }
+        }
+    }
+    add_phase(p, num_packets, now_ns() - start);
+    return true;
+}
+
+static void server_stream_destroy(quicly_stream_t *stream, quicly_error_t err)
+{
+    free(stream->data);
+}
+
+static void server_stream_send_shift(quicly_stream_t *stream, size_t delta)
+{
+    *(uint64_t *)stream->data += delta;
+}
+
+static void server_stream_send_emit(quicly_stream_t *stream, size_t off, void *dst, size_t *len, int *wrote_all)
+{
+    payload_fill(payload, 0, *(uint64_t *)stream->data + off, dst, *len);
+    *wrote_all = 0;
+}
+
+static void stream_send_stop(quicly_stream_t *stream, quicly_error_t err)
+{
+}
+
+static void server_stream_receive(quicly_stream_t *stream, size_t off, const void *src, size_t len)
+{
+    quicly_stream_sync_recvbuf(stream, len);
+}
+
+static void stream_receive_reset(quicly_stream_t *stream, quicly_error_t err)
+{
+}
+
+static void client_stream_receive(quicly_stream_t *stream, size_t off, const void *src, size_t len)
+{
+    // time spent in quicly before the first byte is handshake, not pipeline
+    measuring = true;
+    report.bytes += len;
+    quicly_stream_sync_recvbuf(stream, len);
+}
+
+static const quicly_stream_callbacks_t server_stream_callbacks = {
+    &server_stream_destroy,
+    &server_stream_send_shift,
+    &server_stream_send_emit,
+    &stream_send_stop,
+    &server_stream_receive,
+    &stream_receive_reset
+};
+
+static const quicly_stream_callbacks_t client_stream_callbacks = {
+    &quicly_streambuf_destroy,
+    &quicly_streambuf_egress_shift,
+    &quicly_streambuf_egress_emit,
+    &stream_send_stop,
+    &client_stream_receive,
+    &stream_receive_reset
+};
+
+static quicly_error_t server_on_stream_open(quicly_stream_open_t *self, quicly_stream_t *stream)
+{
+    stream->data = calloc(1, sizeof(uint64_t));
+    stream->callbacks = &server_stream_callbacks;
+    quicly_stream_sync_sendbuf(stream, 1);
+    return 0;
+}
+
+static quicly_error_t client_on_stream_open(quicly_stream_open_t *self, quicly_stream_t *stream)
+{
+    int ret = quicly_streambuf_create(stream, sizeof(quicly_streambuf_t));
+    assert(ret == 0);
+    stream->callbacks = &client_stream_callbacks;
+    return 0;
+}
+
+static quicly_stream_open_t server_stream_open = {&server_on_stream_open};
+static quicly_stream_open_t client_stream_open = {&client_on_stream_open};
+
+static void print_phase(const char *name, const phase *p, double seconds)
+{
+    printf(", %s: %.0f packets/s %.0f ns/packet", name, p->packets / seconds, p->packets != 0 ? (double)p->ns / p->packets : 0);
+    if(p->empty_calls != 0) {
+        printf(" (%.0f empty calls/s %.0f ns/call)", p->empty_calls / seconds, (double)p->empty_ns / p->empty_calls);
+    }
+}
+
+static void print_counters(const char *prefix, const counters *c, double seconds)
+{
+    printf("%s: %.3f gbit/s", prefix, c->bytes * 8 / seconds / 1e9);
+    print_phase("data send", &c->data_send, seconds);
+    print_phase("data receive", &c->data_receive, seconds);
+    print_phase("ack send", &c->ack_send, seconds);
+    print_phase("ack receive", &c->ack_receive, seconds);
+    printf("\n");
+    fflush(stdout);
+}
+
+static void add_phases(phase *dst, const phase *src)
+{
+    dst->packets += src->packets;
+    dst->ns += src->ns;
+    dst->empty_calls += src->empty_calls;
+    dst->empty_ns += src->empty_ns;
+}
+
+static void add_counters(counters *dst, const counters *src)
+{
+    add_phases(&dst->data_send, &src->data_send);
+    add_phases(&dst->data_receive, &src->data_receive);
+    add_phases(&dst->ack_send, &src->ack_send);
+    add_phases(&dst->ack_receive, &src->ack_receive);
+    dst->bytes += src->bytes;
+}
+
+static void setup_context(quicly_context_t *ctx, ptls_context_t *tls, const char *cc, int iw)
+{
+    *ctx = quicly_spec_context;
+    ctx->tls = tls;
+    ctx->transport_params.max_stream_data.uni = UINT32_MAX;
+    ctx->transport_params.max_stream_data.bidi_local = UINT32_MAX;
+    ctx->transport_params.max_stream_data.bidi_remote = UINT32_MAX;
+    ctx->initcwnd_packets = iw;
+    ctx->init_cc = strcmp(cc, "cubic") == 0 ? &quicly_cc_cubic_init : &quicly_cc_reno_init;
+}
+
+static void usage(const char *cmd)
+{
+    printf("Usage: %s [options]\n"
+            "\n"
+            "Runs a qperf client and server connection in one process, exchanging packets through memory\n"
+            "instead of sockets, and reports the cost of quicly and picotls per packet.\n"
+            "\n"
+            "Options:\n"
+            "  --batch n            datagrams built per quicly_send call (default 16, max 64)\n"
+            "  --cc [reno,cubic]    congestion control algorithm to use (default reno)\n"
+            "  --certs dir          directory with server.crt and server.key (default .)\n"
+            "  --iw initial-window  initial window to use (default 10)\n"
+            "  --payload mode       pattern (default), random or none\n"
+            "  -t time (s)          run for X seconds (default 10s)\n"
+            "  -h                   print this help\n"
+            "\n",
+           cmd);
+}
+
+static struct option long_options[] =
+{
+    {"cc", required_argument, NULL, 0},
+    {"iw", required_argument, NULL, 1},
+    {"batch", required_argument, NULL, 2},
+    {"payload", required_argument, NULL, 3},
+    {"certs", required_argument, NULL, 4},
+    {NULL, 0, NULL, 0}
+};
+
+int main(int argc, char **argv)
+{
+    const char *cc = "reno";
+    int iw = 10;
+    int runtime_s = 10;
+    const char *cert_dir = ".";
+    int ch;
+
+    while ((ch = getopt_long(argc, argv, "t:h", long_options, NULL)) != -1) {
+        switch (ch) {
+        case 0:
+            if(strcmp(optarg, "reno") != 0 && strcmp(optarg, "cubic") != 0) {
+                fprintf(stderr, "invalid argument passed to --cc\n");
+                exit(1);
+            }
+            cc = optarg;
+            break;
+        case 1:
+            if(sscanf(optarg, "%u", &iw) != 1 || iw < 1) {
+                fprintf(stderr, "invalid argument passed to --iw\n");
+                exit(1);
+            }
+            break;
+        case 2: {
+            int batch;
+            if(sscanf(optarg, "%u", &batch) != 1 || batch < 1 || batch > MAX_SEND_BATCH_SIZE) {
+                fprintf(stderr, "invalid argument passed to --batch\n");
+                exit(1);
+            }
+            batch_size = batch;
+            break;
+        }
+        case 3:
+            if(!parse_payload_mode(optarg, &payload)) {
+                fprintf(stderr, "invalid argument passed to --payload\n");
+                exit(1);
+            }
+            break;
+        case 4:
+            cert_dir = optarg;
+            break;
+        case 't':
+            if(sscanf(optarg, "%u", &runtime_s) != 1 || runtime_s < 1) {
+                fprintf(stderr, "invalid argument passed to -t\n");
+                exit(1);
+            }
+            break;
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    quicly_amend_ptls_context(get_tlsctx());
+    setup_context(&client_ctx, get_tlsctx(), cc, iw);
+    client_ctx.stream_open = &client_stream_open;
+
+    // the server gets its own TLS context so the client does not carry its certificate
+    server_tls = *get_tlsctx();
+    setup_context(&server_ctx, &server_tls, cc, iw);
+    server_ctx.stream_open = &server_stream_open;
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/server.crt", cert_dir);
+    load_certificate_chain(&server_tls, path);
+    snprintf(path, sizeof(path), "%s/server.key", cert_dir);
+    load_private_key(&server_tls, path);
+
+    // addresses only identify the peers, nothing is sent to them
+    struct sockaddr_in client_addr = {.sin_family = AF_INET, .sin_port = htons(1), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    struct sockaddr_in server_addr = {.sin_family = AF_INET, .sin_port = htons(2), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+
+    packet_queue to_client, to_server;
+    queue_init(&to_client, server_ctx.transport_params.max_udp_payload_size);
+    queue_init(&to_server, client_ctx.transport_params.max_udp_payload_size);
+
+    quicly_conn_t *client = NULL, *server = NULL;
+    quicly_cid_plaintext_t client_cid = {0};
+    if(quicly_connect(&client, &client_ctx, "localhost", (struct sockaddr *)&server_addr, NULL, &client_cid, ptls_iovec_init(NULL, 0),
+                      NULL, NULL, NULL) != 0) {
+        fprintf(stderr, "quicly_connect failed\n");
+        exit(1);
+    }
+    quicly_stream_t *stream;
+    quicly_open_stream(client, &stream, 0);
+    quicly_streambuf_egress_write(stream, "x", 1);
+    quicly_streambuf_egress_shutdown(stream);
+
+    printf("running for %is, cc %s, iw %i, batch %zu, payload %s\n", runtime_s, cc, iw, batch_size, payload_mode_name(payload));
+
+    int64_t start = 0, report_start = 0, handshake_deadline = now_ns() + 10000000000LL;
+    int second = 0;
+    while(second < runtime_s) {
+        if(!send_into(client, &to_server, &report.ack_send) ||
+           !receive_from(&server_ctx, &server, &to_server, (struct sockaddr *)&client_addr, &report.ack_receive) ||
+           (server != NULL && !send_into(server, &to_client, &report.data_send)) ||
+           !receive_from(&client_ctx, &client, &to_client, (struct sockaddr *)&server_addr, &report.data_receive)) {
+            exit(1);
+        }
+
+        if(!measuring) {
+            if(now_ns() > handshake_deadline) {
+                fprintf(stderr, "no data received after 10s\n");
+                exit(1);
+            }
+            continue;
+        }
+        int64_t now = now_ns();
+        if(start == 0) {
+            start = report_start = now;
+        } else if(now - report_start >= 1000000000) {
+            char prefix[32];
+            sprintf(prefix, "second %i", second++);
+            print_counters(prefix, &report, (now - report_start) / 1e9);
+            add_counters(&total, &report);
+            memset(&report, 0, sizeof(report));
+            report_start = now;
+        }
+    }
+
+    print_counters("total", &total, (report_start - start) / 1e9);
+    quicly_free(client);
+    quicly_free(server);
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include "payload.h"
+
+#include <string.h>
+
+/* expected payload is generated and compared in blocks that stay in L1 */
+#define PAYLOAD_BLOCK 4096
+
+static const char *mode_names[] = {"pattern", "random", "none"};
+
+bool parse_payload_mode(const char *src, payload_mode *mode)
+{
+    for(int i = 0; i < sizeof(mode_names) / sizeof(mode_names[0]); ++i) {
+        if(strcmp(src, mode_names[i]) == 0) {
+            *mode = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *payload_mode_name(payload_mode mode)
+{
+    return mode_names[mode];
+}
+
+static inline uint64_t random_word(uint64_t seed, uint64_t index)
+{
+    // splitmix64 seeked to index, so every 8 byte word can be computed on its own
+    uint64_t z = seed + (index + 1) * 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline void store_le64(uint8_t *dst, uint64_t val)
+{
+    // little endian on the wire so hosts of different byte order agree, compilers turn this into a single store
+    for(int i = 0; i < 8; ++i) {
+        dst[i] = val >> (8 * i);
+    }
+}
+
+static void fill_random(uint64_t seed, uint64_t offset, uint8_t *dst, size_t len)
+{
+    uint8_t block[PAYLOAD_BLOCK];
+    while(len > 0) {
+        size_t skip = offset % sizeof(uint64_t);
+        size_t n = len < sizeof(block) - skip ? len : sizeof(block) - skip;
+        size_t num_words = (skip + n + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+        uint64_t first_word = offset / sizeof(uint64_t);
+        for(size_t i = 0; i < num_words; ++i) {
+            store_le64(block + i * sizeof(uint64_t), random_word(seed, first_word + i));
+        }
+        memcpy(dst, block + skip, n);
+        dst += n;
+        offset += n;
+        len -= n;
+    }
+}
+
+void payload_fill(payload_mode mode, uint64_t seed, uint64_t offset, void *dst, size_t len)
+{
+    switch(mode) {
+    case PAYLOAD_PATTERN:
+        memset(dst, 0x58, len);
+        break;
+    case PAYLOAD_RANDOM:
+        fill_random(seed, offset, dst, len);
+        break;
+    case PAYLOAD_NONE:
+        break;
+    }
+}
+
+size_t payload_verify(payload_mode mode, uint64_t seed, uint64_t offset, const void *src, size_t len, size_t *first_error)
+{
+    if(mode == PAYLOAD_NONE) {
+        return 0;
+    }
+
+    // memcmp is vectorized by the C library, so the common case of a matching block runs at memory speed
+    const uint8_t *data = src;
+    uint8_t expected[PAYLOAD_BLOCK];
+    size_t num_errors = 0;
+    for(size_t done = 0; done < len; ) {
+        size_t n = len - done < sizeof(expected) ? len - done : sizeof(expected);
+        payload_fill(mode, seed, offset + done, expected, n);
+        if(memcmp(data + done, expected, n) != 0) {
+            for(size_t i = 0; i < n; ++i) {
+                if(data[done + i] != expected[i]) {
+                    if(num_errors == 0) {
+                        *first_error = done + i;
+                    }
+                    ++num_errors;
+                }
+            }
+        }
+        done += n;
+    }
+    return num_errors;
+}
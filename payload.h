@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum
+{
+    PAYLOAD_PATTERN, // every byte is 'X', what qperf always sent
+    PAYLOAD_RANDOM,  // incompressible, derived from a seed and the stream offset only
+    PAYLOAD_NONE     // buffers are not written at all, to measure the transport alone
+} payload_mode;
+
+bool parse_payload_mode(const char *src, payload_mode *mode);
+const char *payload_mode_name(payload_mode mode);
+
+/* writes the payload bytes [offset, offset + len) of a stream */
+void payload_fill(payload_mode mode, uint64_t seed, uint64_t offset, void *dst, size_t len);
+/* returns the number of bytes in src that differ from the payload at offset, the first one is stored in first_error */
+size_t payload_verify(payload_mode mode, uint64_t seed, uint64_t offset, const void *src, size_t len, size_t *first_error);
@@ -0,0 +1,52 @@
+#include "pool.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+void pool_init(object_pool *pool, size_t object_size, size_t objects_per_slab)
+{
+    // objects double as free list entries and must stay aligned for any member type
+    size_t align = _Alignof(max_align_t);
+    size_t size = object_size < sizeof(void *) ? sizeof(void *) : object_size;
+    pool->object_size = (size + align - 1) / align * align;
+    pool->objects_per_slab = objects_per_slab;
+    pool->free_list = NULL;
+    pool->num_slabs = 0;
+    pool->num_in_use = 0;
+}
+
+static void add_slab(object_pool *pool)
+{
+    char *slab = malloc(pool->object_size * pool->objects_per_slab);
+    assert(slab != NULL);
+    for(size_t i = pool->objects_per_slab; i > 0; --i) {
+        void *object = slab + (i - 1) * pool->object_size;
+        *(void **)object = pool->free_list;
+        pool->free_list = object;
+    }
+    ++pool->num_slabs;
+}
+
+void *pool_alloc(object_pool *pool)
+{
+    if(pool->free_list == NULL) {
+        add_slab(pool);
+    }
+
+    void *object = pool->free_list;
+    pool->free_list = *(void **)object;
+    ++pool->num_in_use;
+    return object;
+}
+
+void pool_free(object_pool *pool, void *object)
+{
+    *(void **)object = pool->free_list;
+    pool->free_list = object;
+    --pool->num_in_use;
+}
+
+size_t pool_reserved_bytes(const object_pool *pool)
+{
+    return pool->num_slabs * pool->objects_per_slab * pool->object_size;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stddef.h>
+
+/* fixed-size object pool, objects are carved out of slabs and recycled through a free list, slabs are never released */
+typedef struct
+{
+    size_t object_size;
+    size_t objects_per_slab;
+    void *free_list;
+    size_t num_slabs;
+    size_t num_in_use;
+} object_pool;
+
+void pool_init(object_pool *pool, size_t object_size, size_t objects_per_slab);
+void *pool_alloc(object_pool *pool);
+void pool_free(object_pool *pool, void *object);
+size_t pool_reserved_bytes(const object_pool *pool);
@@ -0,0 +1,192 @@
+#include "run_summary.h"
+#include "client_stream.h"
+#include "stats.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* the throughput counts as steady once this many consecutive seconds vary by less than STEADY_MAX_CV */
+#define STEADY_WINDOW 3
+#define STEADY_MAX_CV 0.1
+
+static int omit_s = 0;
+static bool detect_steady_state = false;
+static sample_set intervals = {0};
+static double ttfb_ms = 0;
+static int result_fd = -1;
+
+void set_omit_seconds(int seconds)
+{
+    omit_s = seconds;
+}
+
+int omit_seconds()
+{
+    return omit_s;
+}
+
+void enable_steady_state_detection()
+{
+    detect_steady_state = true;
+}
+
+void run_summary_on_first_byte(double ms)
+{
+    ttfb_ms = ms;
+}
+
+bool run_summary_add_interval(int second, uint64_t bytes)
+{
+    // intervals are reported in order, so the index of a value is its second
+    sample_set_add(&intervals, bytes);
+    return second >= omit_s;
+}
+
+static void mean_stddev(const int64_t *values, int num, double *mean, double *stddev)
+{
+    *mean = 0;
+    *stddev = 0;
+    for(int i = 0; i < num; ++i) {
+        *mean += (double)values[i] / num;
+    }
+    if(num > 1) {
+        double var = 0;
+        for(int i = 0; i < num; ++i) {
+            var += (values[i] - *mean) * (values[i] - *mean) / (num - 1);
+        }
+        *stddev = sqrt(var);
+    }
+}
+
+static int find_steady_state(int first)
+{
+    for(int i = first; i + STEADY_WINDOW <= intervals.num_values; ++i) {
+        double mean, stddev;
+        mean_stddev(intervals.values + i, STEADY_WINDOW, &mean, &stddev);
+        if(mean > 0 && stddev / mean < STEADY_MAX_CV) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void compute_summary(run_summary *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->ttfb_ms = ttfb_ms;
+    s->first_second = omit_s;
+    s->steady = !detect_steady_state;
+    if(detect_steady_state) {
+        int steady_second = find_steady_state(omit_s);
+        if(steady_second != -1) {
+            s->first_second = steady_second;
+            s->steady = true;
+        }
+    }
+    if(s->first_second >= intervals.num_values) {
+        return;
+    }
+
+    s->num_intervals = intervals.num_values - s->first_second;
+    mean_stddev(intervals.values + s->first_second, s->num_intervals, &s->mean, &s->stddev);
+
+    sample_set sorted = {0};
+    for(int i = s->first_second; i < intervals.num_values; ++i) {
+        sample_set_add(&sorted, intervals.values[i]);
+    }
+    sample_set_sort(&sorted);
+    s->median = sample_set_percentile(&sorted, 50);
+    s->min = sorted.values[0];
+    s->max = sorted.values[sorted.num_values - 1];
+    free(sorted.values);
+}
+
+void run_summary_print()
+{
+    run_summary s;
+    compute_summary(&s);
+
+    if(detect_steady_state && !s.steady) {
+        printf("steady state not reached: no %i consecutive seconds within %.0f%% of their mean\n", STEADY_WINDOW,
+               STEADY_MAX_CV * 100);
+    }
+    if(s.num_intervals > 0) {
+        char mean[100], median[100], stddev[100], min[100], max[100];
+        format_size(mean, s.mean);
+        format_size(median, s.median);
+        format_size(stddev, s.stddev);
+        format_size(min, s.min);
+        format_size(max, s.max);
+        printf("summary of seconds %i-%i%s: mean %s, median %s, stddev %s, min %s, max %s\n", s.first_second,
+               s.first_second + s.num_intervals - 1, detect_steady_state && s.steady ? " (steady state)" : "", mean, median,
+               stddev, min, max);
+    }
+    fflush(stdout);
+
+    if(result_fd != -1) {
+        if(write(result_fd, &s, sizeof(s)) != sizeof(s)) {
+            perror("writing run result failed");
+        }
+        close(result_fd);
+        result_fd = -1;
+    }
+}
+
+void run_summary_set_result_fd(int fd)
+{
+    result_fd = fd;
+}
+
+static void print_estimate(const char *name, const double *values, int num, bool bytes)
+{
+    double mean = 0, var = 0, min = values[0], max = values[0];
+    for(int i = 0; i < num; ++i) {
+        mean += values[i] / num;
+        min = values[i] < min ? values[i] : min;
+        max = values[i] > max ? values[i] : max;
+    }
+    for(int i = 0; i < num; ++i) {
+        var += num > 1 ? (values[i] - mean) * (values[i] - mean) / (num - 1) : 0;
+    }
+    double ci = num > 1 ? t_quantile_975(num - 1) * sqrt(var / num) : 0;
+
+    if(bytes) {
+        char mean_str[100], ci_str[100], min_str[100], max_str[100];
+        format_size(mean_str, mean);
+        format_size(ci_str, ci);
+        format_size(min_str, min);
+        format_size(max_str, max);
+        printf("%s: %s +- %s (95%% CI), min %s, max %s\n", name, mean_str, ci_str, min_str, max_str);
+    } else {
+        printf("%s: %.3fms +- %.3fms (95%% CI), min %.3fms, max %.3fms\n", name, mean, ci, min, max);
+    }
+}
+
+void run_summary_print_repeated(const run_summary *runs, int num_runs)
+{
+    double values[num_runs];
+    int num_values = 0;
+    int num_steady = 0;
+    for(int i = 0; i < num_runs; ++i) {
+        if(runs[i].num_intervals > 0) {
+            values[num_values++] = runs[i].mean;
+        }
+        num_steady += runs[i].steady;
+    }
+
+    printf("%i runs", num_runs);
+    if(detect_steady_state) {
+        printf(", steady state reached in %i", num_steady);
+    }
+    printf("\n");
+    if(num_values > 0) {
+        print_estimate("mean throughput", values, num_values, true);
+    }
+    for(int i = 0; i < num_runs; ++i) {
+        values[i] = runs[i].ttfb_ms;
+    }
+    print_estimate("time to first byte", values, num_runs, false);
+}
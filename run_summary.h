@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct
+{
+    // throughput of the summarized intervals in bytes per second
+    double mean;
+    double median;
+    double stddev;
+    double min;
+    double max;
+    int first_second;
+    int num_intervals;
+    bool steady;
+    double ttfb_ms;
+} run_summary;
+
+/* leave the first seconds out of the summary, the run is extended by them */
+void set_omit_seconds(int seconds);
+int omit_seconds();
+/* start the summary once the throughput of a few consecutive seconds stopped varying */
+void enable_steady_state_detection();
+void run_summary_on_first_byte(double ttfb_ms);
+/* records the bytes of a report interval, returns false if the interval is omitted */
+bool run_summary_add_interval(int second, uint64_t bytes);
+/* prints the summary of the run so far, and hands it to a repeated run if there is one */
+void run_summary_print();
+void run_summary_set_result_fd(int fd);
+/* prints the mean of the runs with its 95% confidence interval */
+void run_summary_print_repeated(const run_summary *runs, int num_runs);
@@ -0,0 +1,255 @@
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE // pthread_setaffinity_np
+#endif
+#include "rx_thread.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+/* power of two, 1024 slots of 4KB cover several times the default socket receive buffer */
+#define RX_RING_SIZE 1024
+/* packets read before they are published to the connection thread */
+#define RX_BATCH 32
+
+typedef struct
+{
+    // written by the reading thread only
+    _Alignas(64) atomic_size_t head;
+    atomic_uint_fast64_t full_waits;
+    // written by the connection thread only
+    _Alignas(64) atomic_size_t tail;
+    rx_packet packets[RX_RING_SIZE];
+} rx_ring;
+
+static bool enabled = false;
+static int rx_cpu = -1;
+static rx_ring ring;
+static int rx_fd = -1;
+// the reading thread sleeps on the read end while the ring is full, the connection thread wakes it after freeing slots
+static int wake_fds[2] = {-1, -1};
+static atomic_bool reader_waiting;
+static struct ev_loop *rx_loop;
+static ev_async rx_async;
+static void (*on_packet)(const rx_packet *);
+static void (*on_batch)();
+
+// connection thread statistics since the last report
+static uint64_t report_packets = 0;
+static uint64_t report_wakeups = 0;
+static uint64_t report_depth_sum = 0;
+static size_t report_max_depth = 0;
+static uint64_t reported_full_waits = 0;
+
+void enable_rx_thread()
+{
+    enabled = true;
+}
+
+bool rx_thread_enabled()
+{
+    return enabled;
+}
+
+void set_rx_thread_cpu(int cpu)
+{
+    rx_cpu = cpu;
+}
+
+bool pin_current_thread(int cpu)
+{
+    #ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if(ret != 0) {
+            fprintf(stderr, "pinning thread to cpu %i failed: %s\n", cpu, strerror(ret));
+            return false;
+        }
+        return true;
+    #else
+        fprintf(stderr, "cpu pinning only supported on linux\n");
+        return false;
+    #endif
+}
+
+/* reads up to max packets into the ring starting at head, returns the number read, 0 once the socket is drained */
+static size_t read_packets(size_t head, size_t max)
+{
+    #ifdef __linux__
+        struct mmsghdr msgs[RX_BATCH];
+        struct iovec vecs[RX_BATCH];
+        union {
+            struct cmsghdr hdr;
+            char buf[RECV_CMSG_SIZE];
+        } cmsgs[RX_BATCH];
+        for(size_t i = 0; i < max; ++i) {
+            rx_packet *p = &ring.packets[(head + i) & (RX_RING_SIZE - 1)];
+            vecs[i] = (struct iovec){.iov_base = p->buf, .iov_len = sizeof(p->buf)};
+            msgs[i].msg_hdr = (struct msghdr){.msg_name = &p->sa, .msg_namelen = sizeof(p->sa), .msg_iov = &vecs[i],
+                                              .msg_iovlen = 1, .msg_control = &cmsgs[i], .msg_controllen = sizeof(cmsgs[i])};
+        }
+        int n = recvmmsg(rx_fd, msgs, max, MSG_DONTWAIT, NULL);
+        if(n == -1) {
+            if(errno != EWOULDBLOCK && errno != EAGAIN) {
+                perror("recvmmsg failed");
+            }
+            return 0;
+        }
+        for(int i = 0; i < n; ++i) {
+            rx_packet *p = &ring.packets[(head + i) & (RX_RING_SIZE - 1)];
+            p->len = msgs[i].msg_len;
+            p->salen = msgs[i].msg_hdr.msg_namelen;
+            read_recv_info(&msgs[i].msg_hdr, &p->info);
+        }
+        return n;
+    #else
+        size_t n = 0;
+        while(n < max) {
+            rx_packet *p = &ring.packets[(head + n) & (RX_RING_SIZE - 1)];
+            p->salen = sizeof(p->sa);
+            ssize_t len = receive_dgram(rx_fd, p->buf, sizeof(p->buf), &p->sa, &p->salen, &p->info);
+            if(len == -1) {
+                if(errno != EWOULDBLOCK && errno != EAGAIN) {
+                    perror("recvmsg failed");
+                }
+                break;
+            }
+            p->len = len;
+            ++n;
+        }
+        return n;
+    #endif
+}
+
+static void wait_for_slots(size_t head)
+{
+    // announce the wait before looking at the tail again, so that a release in between is not missed
+    atomic_store(&reader_waiting, true);
+    if(head - atomic_load(&ring.tail) == RX_RING_SIZE) {
+        struct pollfd pfd = {.fd = wake_fds[0], .events = POLLIN};
+        if(poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+            perror("poll failed");
+            exit(1);
+        }
+        char buf[16];
+        while(read(wake_fds[0], buf, sizeof(buf)) > 0) {
+        }
+    }
+    atomic_store(&reader_waiting, false);
+}
+
+static void *rx_thread_main(void *arg)
+{
+    if(rx_cpu != -1 && !pin_current_thread(rx_cpu)) {
+        exit(1);
+    }
+
+    struct pollfd pfd = {.fd = rx_fd, .events = POLLIN};
+    size_t head = 0;
+    bool waiting = false;
+    while(true) {
+        size_t tail = atomic_load_explicit(&ring.tail, memory_order_acquire);
+        if(head - tail == RX_RING_SIZE) {
+            // the connection thread is behind, leave further packets in the socket queue until it caught up
+            if(!waiting) {
+                atomic_fetch_add_explicit(&ring.full_waits, 1, memory_order_relaxed);
+                waiting = true;
+            }
+            wait_for_slots(head);
+            continue;
+        }
+        waiting = false;
+
+        size_t free_slots = RX_RING_SIZE - (head - tail);
+        size_t max = free_slots < RX_BATCH ? free_slots : RX_BATCH;
+        size_t n = read_packets(head, max);
+        if(n > 0) {
+            head += n;
+            atomic_store_explicit(&ring.head, head, memory_order_release);
+            ev_async_send(rx_loop, &rx_async);
+        }
+        if(n < max && poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+            perror("poll failed");
+            exit(1);
+        }
+    }
+    return NULL;
+}
+
+static void release_slots(size_t tail)
+{
+    atomic_store(&ring.tail, tail);
+    if(atomic_load(&reader_waiting) && write(wake_fds[1], "", 1) == -1 && errno != EAGAIN) {
+        perror("waking the rx thread failed");
+    }
+}
+
+static void rx_async_cb(EV_P_ ev_async *w, int revents)
+{
+    size_t tail = atomic_load_explicit(&ring.tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring.head, memory_order_acquire);
+    size_t depth = head - tail;
+    ++report_wakeups;
+    report_depth_sum += depth;
+    report_max_depth = depth > report_max_depth ? depth : report_max_depth;
+    report_packets += depth;
+
+    while(tail != head) {
+        on_packet(&ring.packets[tail & (RX_RING_SIZE - 1)]);
+        ++tail;
+        // hand slots back in batches, so the reading thread can continue while the rest is processed
+        if(tail % RX_BATCH == 0) {
+            release_slots(tail);
+        }
+    }
+    release_slots(tail);
+    on_batch();
+}
+
+bool rx_thread_start(struct ev_loop *loop, int fd, void (*packet_cb)(const rx_packet *), void (*batch_cb)())
+{
+    rx_fd = fd;
+    rx_loop = loop;
+    on_packet = packet_cb;
+    on_batch = batch_cb;
+    ev_async_init(&rx_async, &rx_async_cb);
+    ev_async_start(loop, &rx_async);
+
+    if(pipe(wake_fds) != 0) {
+        perror("pipe failed");
+        return false;
+    }
+    fcntl(wake_fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(wake_fds[1], F_SETFL, O_NONBLOCK);
+
+    pthread_t thread;
+    int ret = pthread_create(&thread, NULL, &rx_thread_main, NULL);
+    if(ret != 0) {
+        fprintf(stderr, "pthread_create failed: %s\n", strerror(ret));
+        return false;
+    }
+    pthread_detach(thread);
+    return true;
+}
+
+void rx_thread_report(const char *prefix)
+{
+    uint64_t full_waits = atomic_load_explicit(&ring.full_waits, memory_order_relaxed);
+    printf("%s rx thread: %lu packets in %lu wake-ups, ring depth mean %.1f max %zu of %i, %lu waits on a full ring\n", prefix,
+           report_packets, report_wakeups, report_wakeups > 0 ? (double)report_depth_sum / report_wakeups : 0.,
+           report_max_depth, RX_RING_SIZE, full_waits - reported_full_waits);
+    report_packets = 0;
+    report_wakeups = 0;
+    report_depth_sum = 0;
+    report_max_depth = 0;
+    reported_full_waits = full_waits;
+}
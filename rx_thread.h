@@ -0,0 +1,28 @@
+#pragma once
+
+#include "common.h"
+
+#include <ev.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+typedef struct
+{
+    uint8_t buf[4096];
+    size_t len;
+    struct sockaddr_storage sa;
+    socklen_t salen;
+    recv_info info;
+} rx_packet;
+
+void enable_rx_thread();
+bool rx_thread_enabled();
+/* cpu of the socket reading thread, -1 leaves it unpinned */
+void set_rx_thread_cpu(int cpu);
+/* starts a thread that drains fd into a ring, packet_cb is called on the loop for every packet and batch_cb after each batch */
+bool rx_thread_start(struct ev_loop *loop, int fd, void (*packet_cb)(const rx_packet *), void (*batch_cb)());
+/* prints packets handed over, wake-ups and the ring depth since the last report */
+void rx_thread_report(const char *prefix);
+/* pins the calling thread to a cpu */
+bool pin_current_thread(int cpu);
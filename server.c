@@ -1,6 +1,14 @@
 ﻿#include "server.h"
 #include "server_stream.h"
+#include "server_datagram.h"
 #include "common.h"
+#include "timestamps.h"
+#include "socket_stats.h"
+#include "ack_stats.h"
+#include "ecn.h"
+#include "pool.h"
+#include "trace.h"
+#include "metrics.h"
 
 #include <stdio.h>
 #include <ev.h>
@@ -9,6 +17,7 @@
 #include <unistd.h>
 #include <inttypes.h>
 #include <stdbool.h>
+#include <sys/resource.h>
 
 #include <quicly/streambuf.h>
 
@@ -16,12 +25,46 @@
 #include <picotls/../../t/util.h>
 
 static quicly_conn_t **conns;
+static trace_conn *conn_traces;
 static int server_socket = -1;
 static quicly_context_t server_ctx;
 static int server_socket;
 static size_t num_conns = 0;
+static size_t conns_capacity = 0;
+static object_pool conn_data_pool;
+static size_t baseline_resident_bytes = 0;
+static ev_timer status_timer;
+static int status_second = 0;
+static size_t status_num_conns = 0;
+static int64_t status_cpu_time_us = 0;
+static unsigned int status_iterations = 0;
+/* beyond this many open connections, new connections and probe streams are only counted in the status line */
+#define QUIET_CONNECTIONS 16
+static unsigned int status_quiet_conns = 0;
+static unsigned int status_quiet_probes = 0;
 static ev_timer server_timeout;
 static quicly_cid_plaintext_t next_cid;
+static rx_timestamps server_rx_timestamps;
+static socket_stats server_socket_stats;
+static ev_timer socket_report_timer;
+static int socket_report_second = 0;
+static const char *metrics_address = NULL;
+static int64_t start_time_us = 0;
+
+/* cumulative counters, the traffic of open connections is only added when scraped */
+typedef struct
+{
+    uint64_t accepted;
+    uint64_t closed;
+    uint64_t handshakes;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t packets_sent;
+    uint64_t packets_received;
+    uint64_t packets_lost;
+} conn_totals;
+
+static conn_totals server_totals;
 
 static int udp_listen(struct addrinfo *addr)
 {
@@ -59,21 +102,90 @@ static inline quicly_conn_t *find_conn(struct sockaddr_storage *sa, socklen_t sa
     return NULL;
 }
 
+static int64_t get_cpu_time_us()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static void status_report_cb(EV_P_ ev_timer *w, int revents)
+{
+    int64_t cpu_time_us = get_cpu_time_us();
+    unsigned int iterations = ev_iteration(EV_A);
+    if(num_conns > 0 || num_conns != status_num_conns) {
+        size_t resident = get_resident_bytes();
+        size_t per_conn = num_conns > 0 ? (max_int64(resident, baseline_resident_bytes) - baseline_resident_bytes) / num_conns : 0;
+        double cpu_us = cpu_time_us - status_cpu_time_us;
+        printf("status second %i: %zu connections, resident %.1f MiB, %.1f KiB per connection (%zu KiB pooled), cpu %.1f%% (%.2fus per connection), %u wake-ups",
+               status_second, num_conns, resident / 1048576., per_conn / 1024.,
+               (pool_reserved_bytes(&conn_data_pool) + server_stream_pool_reserved_bytes()) / 1024,
+               cpu_us / 10000., num_conns > 0 ? cpu_us / num_conns : 0.,
+               iterations - status_iterations);
+        if(status_quiet_conns != 0 || status_quiet_probes != 0) {
+            printf(", %u new connections, %u probe streams", status_quiet_conns, status_quiet_probes);
+            status_quiet_conns = 0;
+            status_quiet_probes = 0;
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    ++status_second;
+    status_num_conns = num_conns;
+    status_cpu_time_us = cpu_time_us;
+    status_iterations = iterations;
+}
+
+void server_log_probe_stream()
+{
+    if(num_conns <= QUIET_CONNECTIONS) {
+        printf("probe stream opened, echoing\n");
+    } else {
+        ++status_quiet_probes;
+    }
+}
+
 static void append_conn(quicly_conn_t *conn)
 {
-    ++num_conns;
-    conns = realloc(conns, sizeof(quicly_conn_t*) * num_conns);
-    assert(conns != NULL);
-    conns[num_conns - 1] = conn;
+    if(num_conns == conns_capacity) {
+        conns_capacity = conns_capacity == 0 ? 64 : conns_capacity * 2;
+        conns = realloc(conns, sizeof(quicly_conn_t*) * conns_capacity);
+        conn_traces = realloc(conn_traces, sizeof(trace_conn) * conns_capacity);
+        assert(conns != NULL && conn_traces != NULL);
+    }
+    memset(&conn_traces[num_conns], 0, sizeof(trace_conn));
+    conns[num_conns++] = conn;
 
-    *quicly_get_data(conn) = calloc(1, sizeof(int64_t));
+    datagram_sender *sender = pool_alloc(&conn_data_pool);
+    memset(sender, 0, sizeof(*sender));
+    *quicly_get_data(conn) = sender;
+}
+
+static void add_conn_totals(conn_totals *totals, quicly_conn_t *conn, quicly_stats_t *stats)
+{
+    if(quicly_get_stats(conn, stats) != 0) {
+        return;
+    }
+    totals->handshakes += quicly_connection_is_ready(conn) ? 1 : 0;
+    totals->bytes_sent += stats->num_bytes.sent;
+    totals->bytes_received += stats->num_bytes.received;
+    totals->packets_sent += stats->num_packets.sent;
+    totals->packets_received += stats->num_packets.received;
+    totals->packets_lost += stats->num_packets.lost;
 }
 
 static size_t remove_conn(size_t i)
 {
-    free(*quicly_get_data(conns[i]));
+    if(metrics_address != NULL) {
+        quicly_stats_t stats;
+        add_conn_totals(&server_totals, conns[i], &stats);
+        ++server_totals.closed;
+    }
+    pool_free(&conn_data_pool, *quicly_get_data(conns[i]));
     quicly_free(conns[i]);
     memmove(conns + i, conns + i + 1, (num_conns - i - 1) * sizeof(quicly_conn_t*));
+    memmove(conn_traces + i, conn_traces + i + 1, (num_conns - i - 1) * sizeof(trace_conn));
     --num_conns;
 
     if (i > 0) {
@@ -87,15 +199,24 @@ static void server_timeout_cb(EV_P_ ev_timer *w, int revents);
 void server_send_pending()
 {
     int64_t next_timeout = INT64_MAX;
+    int64_t now = server_ctx.now->cb(server_ctx.now);
     for(size_t i = 0; i < num_conns; ++i) {
-        if(!send_pending(&server_ctx, server_socket, conns[i])) {
+        datagram_sender *sender = *quicly_get_data(conns[i]);
+        trace_conn_update(conns[i], &conn_traces[i]);
+        bool ok = sender->active ?
+                    server_datagram_send_pending(&server_ctx, server_socket, conns[i], sender) :
+                    send_pending(&server_ctx, server_socket, conns[i]);
+        if(!ok) {
             i = remove_conn(i);
         } else {
             next_timeout = min_int64(quicly_get_first_timeout(conns[i]), next_timeout);
+            if(sender->active && sender->rate != 0) {
+                // rate limited senders need to be woken up to refill their budget
+                next_timeout = min_int64(now + DATAGRAM_WAKEUP_US / 1000, next_timeout);
+            }
         }
     }
 
-    int64_t now = server_ctx.now->cb(server_ctx.now);
     int64_t timeout = clamp_int64(next_timeout - now, 1, 200);
     server_timeout.repeat = timeout / 1000.;
     ev_timer_again(EV_DEFAULT, &server_timeout);
@@ -117,8 +238,14 @@ static inline void server_handle_packet(quicly_decoded_packet_t *packet, struct
             return;
         }
         ++next_cid.master_id;
-        printf("got new connection\n");
+        ++server_totals.accepted;
+        if(num_conns < QUIET_CONNECTIONS) {
+            printf("got new connection\n");
+        } else {
+            ++status_quiet_conns;
+        }
         append_conn(conn);
+        trace_packet_received(conn, packet->octets.len);
 
     } else {
         int ret = quicly_receive(conn, NULL, (struct sockaddr *) sa, packet);
@@ -126,6 +253,7 @@ static inline void server_handle_packet(quicly_decoded_packet_t *packet, struct
             fprintf(stderr, "quicly_receive returned %i\n", ret);
             exit(1);
         }
+        trace_packet_received(conn, packet->octets.len);
     }
 }
 
@@ -136,14 +264,18 @@ static void server_read_cb(EV_P_ ev_io *w, int revents)
     struct sockaddr_storage sa;
     socklen_t salen = sizeof(sa);
     quicly_decoded_packet_t packet;
+    recv_info info;
     ssize_t bytes_received;
 
-    while((bytes_received = recvfrom(w->fd, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr *)&sa, &salen)) != -1) {
+    while((bytes_received = receive_dgram(w->fd, buf, sizeof(buf), &sa, &salen, &info)) != -1) {
+        rx_timestamps_record(&server_rx_timestamps, &info);
+        socket_stats_record(&server_socket_stats, &info);
         for(size_t offset = 0; offset < bytes_received; ) {
             size_t packet_len = quicly_decode_packet(&server_ctx, &packet, buf, bytes_received, &offset);
             if(packet_len == SIZE_MAX) {
                 break;
             }
+            packet.ecn = info.ecn;
             server_handle_packet(&packet, &sa, salen);
         }
     }
@@ -155,6 +287,19 @@ static void server_read_cb(EV_P_ ev_io *w, int revents)
     server_send_pending();
 }
 
+static void socket_report_cb(EV_P_ ev_timer *w, int revents)
+{
+    char prefix[64];
+    sprintf(prefix, "socket second %i", socket_report_second++);
+    if(rx_timestamps_enabled()) {
+        rx_timestamps_report(&server_rx_timestamps, prefix);
+    }
+    if(drop_stats_enabled()) {
+        socket_stats_report(&server_socket_stats, prefix);
+    }
+    fflush(stdout);
+}
+
 static void server_on_conn_close(quicly_closed_by_remote_t *self, quicly_conn_t *conn, quicly_error_t err,
                                  uint64_t frame_type, const char *reason, size_t reason_len)
 {
@@ -171,6 +316,63 @@ static void server_on_conn_close(quicly_closed_by_remote_t *self, quicly_conn_t
     }
 }
 
+static void write_counter(FILE *out, const char *name, const char *help, uint64_t value)
+{
+    fprintf(out, "# HELP %s %s\n# TYPE %s counter\n%s %" PRIu64 "\n", name, help, name, name, value);
+}
+
+static void server_write_metrics(FILE *out)
+{
+    conn_totals totals = server_totals;
+    quicly_stats_t *stats = malloc(sizeof(quicly_stats_t) * (num_conns > 0 ? num_conns : 1));
+    assert(stats != NULL);
+    for(size_t i = 0; i < num_conns; ++i) {
+        add_conn_totals(&totals, conns[i], &stats[i]);
+    }
+
+    write_counter(out, "qperf_connections_accepted_total", "Connections accepted.", totals.accepted);
+    write_counter(out, "qperf_connections_closed_total", "Connections closed and freed.", totals.closed);
+    write_counter(out, "qperf_handshakes_total", "Connections that completed the handshake.", totals.handshakes);
+    write_counter(out, "qperf_sent_bytes_total", "UDP payload bytes sent.", totals.bytes_sent);
+    write_counter(out, "qperf_received_bytes_total", "UDP payload bytes received.", totals.bytes_received);
+    write_counter(out, "qperf_sent_packets_total", "QUIC packets sent.", totals.packets_sent);
+    write_counter(out, "qperf_received_packets_total", "QUIC packets received.", totals.packets_received);
+    write_counter(out, "qperf_lost_packets_total", "QUIC packets declared lost.", totals.packets_lost);
+    if(drop_stats_enabled()) {
+        write_counter(out, "qperf_socket_drops_total", "Packets dropped by the kernel because the socket queue was full.",
+                      server_socket_stats.rxq_drops);
+    }
+
+    fprintf(out, "# HELP qperf_connections Open connections.\n# TYPE qperf_connections gauge\nqperf_connections %zu\n", num_conns);
+    fprintf(out, "# HELP qperf_uptime_seconds Time since the server started.\n# TYPE qperf_uptime_seconds gauge\n"
+            "qperf_uptime_seconds %.3f\n", (get_time_us() - start_time_us) / 1e6);
+    fprintf(out, "# HELP qperf_resident_bytes Resident set size of the server.\n# TYPE qperf_resident_bytes gauge\n"
+            "qperf_resident_bytes %zu\n", get_resident_bytes());
+
+    // per connection gauges, labelled with the master id that --trace uses as group_id
+    fprintf(out, "# HELP qperf_connection_cwnd_bytes Congestion window.\n# TYPE qperf_connection_cwnd_bytes gauge\n");
+    for(size_t i = 0; i < num_conns; ++i) {
+        fprintf(out, "qperf_connection_cwnd_bytes{conn=\"%" PRIu32 "\"} %" PRIu32 "\n", quicly_get_master_id(conns[i])->master_id,
+                stats[i].cc.cwnd);
+    }
+    fprintf(out, "# HELP qperf_connection_srtt_seconds Smoothed RTT.\n# TYPE qperf_connection_srtt_seconds gauge\n");
+    for(size_t i = 0; i < num_conns; ++i) {
+        fprintf(out, "qperf_connection_srtt_seconds{conn=\"%" PRIu32 "\"} %.3f\n", quicly_get_master_id(conns[i])->master_id,
+                stats[i].rtt.smoothed / 1000.);
+    }
+    fprintf(out, "# HELP qperf_connection_min_rtt_seconds Minimum RTT.\n# TYPE qperf_connection_min_rtt_seconds gauge\n");
+    for(size_t i = 0; i < num_conns; ++i) {
+        fprintf(out, "qperf_connection_min_rtt_seconds{conn=\"%" PRIu32 "\"} %.3f\n", quicly_get_master_id(conns[i])->master_id,
+                stats[i].rtt.minimum / 1000.);
+    }
+    free(stats);
+}
+
+void server_set_metrics_address(const char *address)
+{
+    metrics_address = address;
+}
+
 static quicly_stream_open_t stream_open = {&server_on_stream_open};
 static quicly_closed_by_remote_t closed_by_remote = {&server_on_conn_close};
 
@@ -186,7 +388,12 @@ int run_server(const char* address, const char *port, bool gso, const char *logf
     server_ctx.transport_params.max_stream_data.uni = UINT32_MAX;
     server_ctx.transport_params.max_stream_data.bidi_local = UINT32_MAX;
     server_ctx.transport_params.max_stream_data.bidi_remote = UINT32_MAX;
+    server_ctx.transport_params.max_datagram_frame_size = UINT16_MAX;
     server_ctx.initcwnd_packets = iw;
+    setup_ack_settings(&server_ctx);
+    setup_ecn_settings(&server_ctx);
+    // lets connections share a client address, they are told apart by their CIDs
+    server_ctx.cid_encryptor = new_cid_encryptor();
 
     if(strcmp(cc, "reno") == 0) {
         server_ctx.init_cc = &quicly_cc_reno_init;
@@ -217,6 +424,10 @@ int run_server(const char* address, const char *port, bool gso, const char *logf
         return 1;
     }
 
+    if(!setup_rx_timestamps(server_socket) || !setup_socket_stats(server_socket, &server_socket_stats) || !setup_ecn(server_socket)) {
+        return 1;
+    }
+
     if (logfile)
     {
         setup_log_event(server_ctx.tls, logfile);
@@ -230,6 +441,23 @@ int run_server(const char* address, const char *port, bool gso, const char *logf
 
     ev_init(&server_timeout, &server_timeout_cb);
 
+    pool_init(&conn_data_pool, sizeof(datagram_sender), 256);
+    server_stream_init();
+    baseline_resident_bytes = get_resident_bytes();
+
+    start_time_us = get_time_us();
+    if(metrics_address != NULL && !metrics_listen(loop, metrics_address, &server_write_metrics)) {
+        return 1;
+    }
+
+    ev_timer_init(&status_timer, &status_report_cb, 1.0, 1.0);
+    ev_timer_start(loop, &status_timer);
+
+    if(rx_timestamps_enabled() || drop_stats_enabled()) {
+        ev_timer_init(&socket_report_timer, &socket_report_cb, 1.0, 1.0);
+        ev_timer_start(loop, &socket_report_timer);
+    }
+
     ev_run(loop, 0);
     return 0;
 }
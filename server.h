@@ -3,5 +3,9 @@
 #include <quicly.h>
 #include <stdbool.h>
 
+/* prints that a probe stream was opened, counted in the status line instead once many connections are open */
+void server_log_probe_stream();
+/* serve Prometheus metrics on this address, see metrics_listen */
+void server_set_metrics_address(const char *address);
 int run_server(const char* address, const char* port, bool gso, const char *logfile, const char *cc, int iw, const char *cert, const char *key);
 
@@ -0,0 +1,82 @@
+#include "server_datagram.h"
+#include "common.h"
+
+#include <stdio.h>
+
+/* quicly accepts at most this many DATAGRAM frames per quicly_send call */
+#define DATAGRAM_QUEUE_SIZE 10
+
+void server_datagram_start(datagram_sender *sender, uint64_t rate)
+{
+    sender->active = true;
+    sender->rate = rate;
+    sender->next_seq = 0;
+    sender->budget = 0;
+    sender->last_refill_us = get_time_us();
+    sender->total_sent = 0;
+    sender->missed_bytes = 0;
+}
+
+static size_t num_allowed(datagram_sender *sender)
+{
+    if(sender->rate == 0) {
+        return DATAGRAM_QUEUE_SIZE;
+    }
+
+    // token bucket holding two wake-ups worth of datagrams, so that a late timer does not cost rate,
+    // it is drained in batches of one queue
+    int64_t now = get_time_us();
+    double limit = max_int64(DATAGRAM_QUEUE_SIZE * DATAGRAM_PAYLOAD_SIZE, sender->rate * 2 * DATAGRAM_WAKEUP_US / 1000000);
+    sender->budget += (now - sender->last_refill_us) * sender->rate / 1000000.;
+    if(sender->budget > limit) {
+        sender->missed_bytes += sender->budget - limit;
+        sender->budget = limit;
+    }
+    sender->last_refill_us = now;
+    return min_int64(sender->budget / DATAGRAM_PAYLOAD_SIZE, DATAGRAM_QUEUE_SIZE);
+}
+
+static uint64_t num_datagrams_sent(quicly_conn_t *conn)
+{
+    quicly_stats_t stats;
+    quicly_get_stats(conn, &stats);
+    return stats.num_frames_sent.datagram;
+}
+
+bool server_datagram_send_pending(quicly_context_t *ctx, int fd, quicly_conn_t *conn, datagram_sender *sender)
+{
+    uint8_t payloads[DATAGRAM_QUEUE_SIZE][DATAGRAM_PAYLOAD_SIZE];
+    ptls_iovec_t datagrams[DATAGRAM_QUEUE_SIZE];
+
+    while(true) {
+        size_t num_queued = num_allowed(sender);
+        for(size_t i = 0; i < num_queued; ++i) {
+            datagram_header hdr = {.seq = sender->next_seq + i, .send_time_us = get_wall_time_us()};
+            memcpy(payloads[i], &hdr, sizeof(hdr));
+            datagrams[i] = ptls_iovec_init(payloads[i], DATAGRAM_PAYLOAD_SIZE);
+        }
+        quicly_send_datagram_frames(conn, datagrams, num_queued);
+
+        uint64_t sent_before = num_datagrams_sent(conn);
+        int num_dgrams = send_batch(ctx, fd, conn);
+        if(num_dgrams < 0) {
+            return false;
+        }
+
+        // quicly drops queued datagrams that did not fit into the congestion window,
+        // reuse their sequence numbers so that the receiver only sees network loss
+        uint64_t num_sent = num_datagrams_sent(conn) - sent_before;
+        sender->next_seq += num_sent;
+        sender->total_sent += num_sent;
+        if(sender->rate != 0) {
+            sender->budget -= num_sent * DATAGRAM_PAYLOAD_SIZE;
+        }
+
+        if(num_dgrams == 0) {
+            return true;
+        } else if(num_queued > 0 && num_sent == 0) {
+            // congestion limited, flush whatever else is pending
+            return send_pending(ctx, fd, conn);
+        }
+    }
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <quicly.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct
+{
+    bool active;
+    uint64_t rate;  // bytes per second, 0 sends as fast as congestion control allows
+    uint64_t next_seq;
+    double budget;
+    int64_t last_refill_us;
+    uint64_t total_sent;
+    uint64_t missed_bytes;  // budget dropped because the sender fell behind, the requested rate was not reached
+} datagram_sender;
+
+/* how often rate limited senders are woken up to refill their budget */
+#define DATAGRAM_WAKEUP_US 1000
+
+void server_datagram_start(datagram_sender *sender, uint64_t rate);
+bool server_datagram_send_pending(quicly_context_t *ctx, int fd, quicly_conn_t *conn, datagram_sender *sender);
@@ -1,4 +1,12 @@
 #include "server_stream.h"
+#include "server.h"
+#include "common.h"
+#include "timestamps.h"
+#include "server_datagram.h"
+#include "ack_stats.h"
+#include "ecn.h"
+#include "pool.h"
+#include "trace.h"
 
 #include <ev.h>
 #include <stdbool.h>
@@ -15,10 +23,28 @@ typedef struct
     uint64_t report_num_packets_lost;
     uint64_t total_num_packets_sent;
     uint64_t total_num_packets_lost;
+    uint64_t total_num_datagrams_sent;
+    uint64_t reported_datagram_missed_bytes;
     ev_timer report_timer;
+    char request[128];
+    size_t request_len;
+    bool request_parsed;
+    bool upload;
+    uint64_t max_emitted_offset;
+    int64_t deadline_us;
+    uint64_t stream_bytes_received;
+    uint64_t reported_bytes_received;
+    payload_mode payload;
+    uint64_t seed;
+    ack_counters acks;
+    ecn_counters ecn;
+    uint64_t reported_paths[4]; // created, validated, validation failed, promoted
+    uint32_t reported_cwnd;
+    uint32_t reported_srtt;
 } server_stream;
 
 static int report_counter = 0;
+static object_pool stream_pool;
 
 static void print_report(server_stream *s)
 {
@@ -29,6 +55,44 @@ static void print_report(server_stream *s)
     s->total_num_packets_sent = stats.num_packets.sent;
     s->total_num_packets_lost = stats.num_packets.lost;
     printf("connection %i second %i send window: %"PRIu32" packets sent: %"PRIu64" packets lost: %"PRIu64"\n", s->report_id, s->report_second, stats.cc.cwnd, s->report_num_packets_sent, s->report_num_packets_lost);
+
+    // a client migration shows up as a new path, cwnd and srtt are compared with the previous report
+    uint64_t paths[4] = {stats.num_paths.created, stats.num_paths.validated, stats.num_paths.validation_failed, stats.num_paths.promoted};
+    if(memcmp(paths, s->reported_paths, sizeof(paths)) != 0) {
+        printf("connection %i second %i paths created: %"PRIu64" validated: %"PRIu64" validation failed: %"PRIu64" promoted: %"PRIu64
+               " send window: %"PRIu32" -> %"PRIu32" srtt: %"PRIu32"ms -> %"PRIu32"ms\n", s->report_id, s->report_second,
+               paths[0] - s->reported_paths[0], paths[1] - s->reported_paths[1], paths[2] - s->reported_paths[2],
+               paths[3] - s->reported_paths[3], s->reported_cwnd, stats.cc.cwnd, s->reported_srtt, stats.rtt.smoothed);
+        memcpy(s->reported_paths, paths, sizeof(paths));
+    }
+    s->reported_cwnd = stats.cc.cwnd;
+    s->reported_srtt = stats.rtt.smoothed;
+
+    datagram_sender *sender = *quicly_get_data(s->stream->conn);
+    if(sender->active) {
+        printf("connection %i second %i datagrams sent: %"PRIu64"\n", s->report_id, s->report_second, sender->total_sent - s->total_num_datagrams_sent);
+        s->total_num_datagrams_sent = sender->total_sent;
+        if(sender->missed_bytes != s->reported_datagram_missed_bytes) {
+            printf("connection %i second %i warning: requested datagram rate not reached, %"PRIu64" bytes behind (congestion or cpu limited)\n",
+                   s->report_id, s->report_second, sender->missed_bytes - s->reported_datagram_missed_bytes);
+            s->reported_datagram_missed_bytes = sender->missed_bytes;
+        }
+    }
+    if(ack_stats_enabled()) {
+        char prefix[64];
+        sprintf(prefix, "connection %i second %i", s->report_id, s->report_second);
+        ack_stats_report(s->stream->conn, &s->acks, prefix);
+    }
+    if(ecn_enabled()) {
+        char prefix[64];
+        sprintf(prefix, "connection %i second %i", s->report_id, s->report_second);
+        ecn_report(s->stream->conn, &s->ecn, prefix);
+    }
+    if(s->upload) {
+        uint64_t bytes_received = s->stream_bytes_received - s->request_len;
+        printf("connection %i second %i bytes received: %"PRIu64"\n", s->report_id, s->report_second, bytes_received - s->reported_bytes_received);
+        s->reported_bytes_received = bytes_received;
+    }
     fflush(stdout);
     ++s->report_second;
 }
@@ -41,10 +105,14 @@ static void server_report_cb(EV_P, ev_timer *w, int revents)
 static void server_stream_destroy(quicly_stream_t *stream, quicly_error_t err)
 {
     server_stream *s = (server_stream*)stream->data;
-    print_report(s);
-    printf("connection %i total packets sent: %"PRIu64" total packets lost: %"PRIu64"\n", s->report_id, s->total_num_packets_sent, s->total_num_packets_lost);
+    trace_stream(stream, false);
+    // streams closed before their request was complete never started reporting
+    if(s->report_id != -1) {
+        print_report(s);
+        printf("connection %i total packets sent: %"PRIu64" total packets lost: %"PRIu64"\n", s->report_id, s->total_num_packets_sent, s->total_num_packets_lost);
+    }
     ev_timer_stop(EV_DEFAULT, &s->report_timer);
-    free(s);
+    pool_free(&stream_pool, s);
 }
 
 static void server_stream_send_shift(quicly_stream_t *stream, size_t delta)
@@ -58,6 +126,10 @@ static void server_stream_send_emit(quicly_stream_t *stream, size_t off, void *d
     server_stream *s = stream->data;
     uint64_t data_off = s->acked_offset + off;
 
+    if(s->deadline_us != 0 && s->target_offset == UINT64_MAX && get_time_us() >= s->deadline_us) {
+        s->target_offset = max_int64(s->max_emitted_offset, data_off + *len);
+    }
+
     if(data_off + *len < s->target_offset) {
         *wrote_all = 0;
     } else {
@@ -66,8 +138,9 @@ static void server_stream_send_emit(quicly_stream_t *stream, size_t off, void *d
         *len = s->target_offset - data_off;
         assert(data_off + *len == s->target_offset);
     }
+    s->max_emitted_offset = max_int64(s->max_emitted_offset, data_off + *len);
 
-    memset(dst, 0x58, *len);
+    payload_fill(s->payload, s->seed, data_off, dst, *len);
 }
 
 static void server_stream_send_stop(quicly_stream_t *stream, quicly_error_t err)
@@ -76,15 +149,151 @@ static void server_stream_send_stop(quicly_stream_t *stream, quicly_error_t err)
     fprintf(stderr, "received STOP_SENDING: %li\n", err);
 }
 
+static void server_probe_echo(quicly_stream_t *stream)
+{
+    // echo probe messages, adding our kernel receive time for one-way delay trends; the client does all the bookkeeping
+    ptls_iovec_t input = quicly_streambuf_ingress_get(stream);
+    size_t consumed = 0;
+    while(input.len - consumed >= sizeof(probe_message)) {
+        probe_message msg;
+        memcpy(&msg, input.base + consumed, sizeof(msg));
+        msg.server_rx_time_us = get_last_rx_time_us();
+        quicly_streambuf_egress_write(stream, &msg, sizeof(msg));
+        consumed += sizeof(msg);
+    }
+    quicly_streambuf_ingress_shift(stream, consumed);
+}
+
+static void server_probe_receive(quicly_stream_t *stream, size_t off, const void *src, size_t len)
+{
+    if(quicly_streambuf_ingress_receive(stream, off, src, len) != 0) {
+        return;
+    }
+    server_probe_echo(stream);
+}
+
+static void server_probe_receive_reset(quicly_stream_t *stream, quicly_error_t err)
+{
+    quicly_stream_sync_sendbuf(stream, 0);
+}
+
+static void server_probe_destroy(quicly_stream_t *stream, quicly_error_t err)
+{
+    trace_stream(stream, false);
+    quicly_streambuf_destroy(stream, err);
+}
+
+static const quicly_stream_callbacks_t server_probe_callbacks = {
+    &server_probe_destroy,
+    &quicly_streambuf_egress_shift,
+    &quicly_streambuf_egress_emit,
+    &server_stream_send_stop,
+    &server_probe_receive,
+    &server_probe_receive_reset
+};
+
+static void server_probe_open(quicly_stream_t *stream, size_t len)
+{
+    // the request buffer holds everything received so far, the probe messages following the request go to the streambuf
+    server_stream *s = stream->data;
+    char received[sizeof(s->request)];
+    memcpy(received, s->request, len);
+    if(len < quicly_recvstate_bytes_available(&stream->recvstate)) {
+        fprintf(stderr, "probe messages exceed the request buffer\n");
+        quicly_close(stream->conn, QUICLY_ERROR_FROM_APPLICATION_ERROR_CODE(2), "invalid request");
+        return;
+    }
+
+    server_log_probe_stream();
+    pool_free(&stream_pool, s);
+    int ret = quicly_streambuf_create(stream, sizeof(quicly_streambuf_t));
+    assert(ret == 0);
+    stream->callbacks = &server_probe_callbacks;
+
+    if(quicly_streambuf_ingress_receive(stream, 0, received, len) != 0) {
+        return;
+    }
+    quicly_streambuf_ingress_shift(stream, strlen(PROBE_REQUEST));
+    server_probe_echo(stream);
+}
+
+static void server_stream_start(quicly_stream_t *stream, server_stream *s)
+{
+    s->report_id = report_counter++;
+
+    uint64_t rate;
+    transfer_params params;
+    if(sscanf(s->request, DATAGRAM_REQUEST " %" SCNu64, &rate) == 1) {
+        if(quicly_get_remote_transport_parameters(stream->conn)->max_datagram_frame_size == 0) {
+            fprintf(stderr, "datagrams requested but not supported by the client\n");
+            quicly_close(stream->conn, QUICLY_ERROR_FROM_APPLICATION_ERROR_CODE(1), "datagrams not supported");
+            return;
+        }
+        printf("datagram request received, sending datagrams\n");
+        server_datagram_start(*quicly_get_data(stream->conn), rate);
+    } else if(parse_request(s->request, &params)) {
+        if(params.upload) {
+            printf("upload request received, receiving data\n");
+            s->upload = true;
+            s->target_offset = 0;
+        } else {
+            printf("request received, sending data\n");
+            if(params.bytes != 0) {
+                s->target_offset = params.bytes;
+            }
+        }
+        s->payload = params.payload;
+        s->seed = params.seed;
+        if(params.duration_s != 0) {
+            s->deadline_us = get_time_us() + params.duration_s * 1000000LL;
+        }
+        quicly_stream_sync_sendbuf(stream, 1);
+    } else {
+        print_escaped(s->request, s->request_len);
+        fprintf(stderr, "invalid request\n");
+        quicly_close(stream->conn, QUICLY_ERROR_FROM_APPLICATION_ERROR_CODE(2), "invalid request");
+        return;
+    }
+    ev_timer_start(EV_DEFAULT, &s->report_timer);
+}
+
 static void server_stream_receive(quicly_stream_t *stream, size_t off, const void *src, size_t len)
 {
     //print_escaped((const char*)src, len);
-    quicly_stream_sync_recvbuf(stream, len);
+    server_stream *s = stream->data;
+    if(!s->request_parsed) {
+        // nothing is consumed before the request is parsed, so off is still the stream offset
+        if(off < sizeof(s->request) - 1) {
+            size_t copy_len = min_int64(len, sizeof(s->request) - 1 - off);
+            memcpy(s->request + off, src, copy_len);
+        }
 
-    if(quicly_recvstate_transfer_complete(&stream->recvstate)) {
-        printf("request received, sending data\n");
-        quicly_stream_sync_sendbuf(stream, 1);
-        ev_timer_start(EV_DEFAULT, &((server_stream*)stream->data)->report_timer);
+        // requests end with a newline (uploads are followed by their payload) or, for older clients, with the stream,
+        // only the contiguous part is looked at as later frames may arrive first
+        size_t available = min_int64(quicly_recvstate_bytes_available(&stream->recvstate), sizeof(s->request) - 1);
+        char *request_end = memchr(s->request, '\n', available);
+        if(request_end == NULL && available < sizeof(s->request) - 1 && !quicly_recvstate_transfer_complete(&stream->recvstate)) {
+            return;
+        }
+        s->request_parsed = true;
+        s->request_len = request_end != NULL ? request_end - s->request + 1 : available;
+        if(s->request_len == strlen(PROBE_REQUEST) && memcmp(s->request, PROBE_REQUEST, s->request_len) == 0) {
+            server_probe_open(stream, available);
+            return;
+        }
+        s->request[s->request_len] = '\0';
+        server_stream_start(stream, s);
+    }
+
+    // the rest is only counted, consume up to the first gap
+    size_t available = quicly_recvstate_bytes_available(&stream->recvstate);
+    if(available != 0) {
+        s->stream_bytes_received += available;
+        quicly_stream_sync_recvbuf(stream, available);
+    }
+
+    if(s->upload && quicly_recvstate_transfer_complete(&stream->recvstate)) {
+        printf("connection %i upload of %"PRIu64" bytes received\n", s->report_id, s->stream_bytes_received - s->request_len);
     }
 }
 
@@ -103,23 +312,50 @@ static const quicly_stream_callbacks_t server_stream_callbacks = {
     &server_stream_receive_reset
 };
 
+void server_stream_init()
+{
+    pool_init(&stream_pool, sizeof(server_stream), 256);
+}
+
+size_t server_stream_pool_reserved_bytes()
+{
+    return pool_reserved_bytes(&stream_pool);
+}
+
 quicly_error_t server_on_stream_open(quicly_stream_open_t *self, quicly_stream_t *stream)
 {
-    server_stream *s = malloc(sizeof(server_stream));
+    server_stream *s = pool_alloc(&stream_pool);
     s->target_offset = UINT64_MAX;
     s->acked_offset = 0;
     s->stream = stream;
-    s->report_id = report_counter++;
+    s->report_id = -1;
     s->report_second = 0;
     s->report_num_packets_sent = 0;
     s->report_num_packets_lost = 0;
     s->total_num_packets_sent = 0;
     s->total_num_packets_lost = 0;
+    s->total_num_datagrams_sent = 0;
+    s->reported_datagram_missed_bytes = 0;
+    s->request_len = 0;
+    s->request_parsed = false;
+    s->upload = false;
+    s->max_emitted_offset = 0;
+    s->deadline_us = 0;
+    s->stream_bytes_received = 0;
+    s->reported_bytes_received = 0;
+    s->payload = PAYLOAD_PATTERN;
+    s->seed = 0;
+    memset(&s->acks, 0, sizeof(s->acks));
+    memset(&s->ecn, 0, sizeof(s->ecn));
+    memset(s->reported_paths, 0, sizeof(s->reported_paths));
+    s->reported_cwnd = 0;
+    s->reported_srtt = 0;
     ev_timer_init(&s->report_timer, server_report_cb, 1.0, 1.0);
     s->report_timer.data = s;
 
     stream->data = s;
     stream->callbacks = &server_stream_callbacks;
+    trace_stream(stream, true);
 
     return 0;
 }
@@ -2,4 +2,6 @@
 
 #include <quicly.h>
 
+void server_stream_init();
+size_t server_stream_pool_reserved_bytes();
 quicly_error_t server_on_stream_open(quicly_stream_open_t *self, quicly_stream_t *stream);
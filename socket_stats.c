@@ -0,0 +1,163 @@
+#include "socket_stats.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#ifdef __linux__
+    #ifndef SO_RXQ_OVFL
+        #define SO_RXQ_OVFL 40
+    #endif
+#endif
+
+static int rcvbuf_size = 0;
+static int sndbuf_size = 0;
+static bool drops_enabled = false;
+
+void set_socket_buffer_sizes(int rcvbuf, int sndbuf)
+{
+    rcvbuf_size = rcvbuf;
+    sndbuf_size = sndbuf;
+}
+
+void enable_drop_stats()
+{
+    drops_enabled = true;
+}
+
+bool drop_stats_enabled()
+{
+    return drops_enabled;
+}
+
+static bool set_buffer_size(int fd, int force_opt, int opt, const char *name, int size)
+{
+    // the FORCE variants ignore rmem_max/wmem_max but need CAP_NET_ADMIN
+    if(force_opt == 0 || setsockopt(fd, SOL_SOCKET, force_opt, &size, sizeof(size)) != 0) {
+        if(setsockopt(fd, SOL_SOCKET, opt, &size, sizeof(size)) != 0) {
+            fprintf(stderr, "setsockopt(%s) failed: %s\n", name, strerror(errno));
+            return false;
+        }
+    }
+
+    int effective = 0;
+    socklen_t len = sizeof(effective);
+    getsockopt(fd, SOL_SOCKET, opt, &effective, &len);
+    printf("%s requested %i bytes, kernel uses %i bytes\n", name, size, effective);
+    return true;
+}
+
+static void read_udp_snmp(udp_snmp_counters *counters)
+{
+    memset(counters, 0, sizeof(*counters));
+
+    #ifdef __linux__
+        char header[512], values[512];
+        FILE *f = fopen("/proc/net/snmp", "r");
+        if(f != NULL) {
+            while(fgets(header, sizeof(header), f) != NULL && fgets(values, sizeof(values), f) != NULL) {
+                if(strncmp(header, "Udp:", 4) != 0) {
+                    continue;
+                }
+                char *hsave, *vsave;
+                char *h = strtok_r(header + 4, " \n", &hsave);
+                char *v = strtok_r(values + 4, " \n", &vsave);
+                for(; h != NULL && v != NULL; h = strtok_r(NULL, " \n", &hsave), v = strtok_r(NULL, " \n", &vsave)) {
+                    if(strcmp(h, "InErrors") == 0) {
+                        counters->in_errors += strtoull(v, NULL, 10);
+                    } else if(strcmp(h, "RcvbufErrors") == 0) {
+                        counters->rcvbuf_errors += strtoull(v, NULL, 10);
+                    } else if(strcmp(h, "SndbufErrors") == 0) {
+                        counters->sndbuf_errors += strtoull(v, NULL, 10);
+                    }
+                }
+                break;
+            }
+            fclose(f);
+        }
+
+        char name[128];
+        unsigned long long value;
+        f = fopen("/proc/net/snmp6", "r");
+        if(f != NULL) {
+            while(fscanf(f, "%127s %llu", name, &value) == 2) {
+                if(strcmp(name, "Udp6InErrors") == 0) {
+                    counters->in_errors += value;
+                } else if(strcmp(name, "Udp6RcvbufErrors") == 0) {
+                    counters->rcvbuf_errors += value;
+                } else if(strcmp(name, "Udp6SndbufErrors") == 0) {
+                    counters->sndbuf_errors += value;
+                }
+            }
+            fclose(f);
+        }
+    #endif
+}
+
+bool setup_socket_stats(int fd, socket_stats *stats)
+{
+    if(rcvbuf_size > 0) {
+        #ifdef __linux__
+            int force_opt = SO_RCVBUFFORCE;
+        #else
+            int force_opt = 0;
+        #endif
+        if(!set_buffer_size(fd, force_opt, SO_RCVBUF, "SO_RCVBUF", rcvbuf_size)) {
+            return false;
+        }
+    }
+
+    if(sndbuf_size > 0) {
+        #ifdef __linux__
+            int force_opt = SO_SNDBUFFORCE;
+        #else
+            int force_opt = 0;
+        #endif
+        if(!set_buffer_size(fd, force_opt, SO_SNDBUF, "SO_SNDBUF", sndbuf_size)) {
+            return false;
+        }
+    }
+
+    if(drops_enabled) {
+        // the drop counter is per socket
+        stats->rxq_drops = 0;
+        stats->reported_rxq_drops = 0;
+        #ifdef __linux__
+            int on = 1;
+            if(setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) != 0) {
+                perror("setsockopt(SO_RXQ_OVFL) failed");
+                return false;
+            }
+        #endif
+        read_udp_snmp(&stats->last_snmp);
+    }
+
+    return true;
+}
+
+void socket_stats_record(socket_stats *stats, const recv_info *info)
+{
+    // the kernel reports the cumulative drop count of the socket with every packet
+    if(info->has_rxq_drops) {
+        stats->rxq_drops = info->rxq_drops;
+    }
+}
+
+void socket_stats_report(socket_stats *stats, const char *prefix)
+{
+    udp_snmp_counters snmp;
+    read_udp_snmp(&snmp);
+
+    printf("%s: socket queue drops %" PRIu32 ", host-wide udp in errors %" PRIu64 " rcvbuf errors %" PRIu64 " sndbuf errors %" PRIu64 "\n",
+           prefix,
+           stats->rxq_drops - stats->reported_rxq_drops,
+           snmp.in_errors - stats->last_snmp.in_errors,
+           snmp.rcvbuf_errors - stats->last_snmp.rcvbuf_errors,
+           snmp.sndbuf_errors - stats->last_snmp.sndbuf_errors);
+
+    stats->reported_rxq_drops = stats->rxq_drops;
+    stats->last_snmp = snmp;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct
+{
+    uint64_t in_errors;
+    uint64_t rcvbuf_errors;
+    uint64_t sndbuf_errors;
+} udp_snmp_counters;
+
+typedef struct
+{
+    uint32_t rxq_drops;
+    uint32_t reported_rxq_drops;
+    udp_snmp_counters last_snmp;
+} socket_stats;
+
+void set_socket_buffer_sizes(int rcvbuf, int sndbuf);
+void enable_drop_stats();
+bool drop_stats_enabled();
+/* applies buffer sizes and enables SO_RXQ_OVFL if requested */
+bool setup_socket_stats(int fd, socket_stats *stats);
+void socket_stats_record(socket_stats *stats, const recv_info *info);
+void socket_stats_report(socket_stats *stats, const char *prefix);
@@ -0,0 +1,49 @@
+#include "stats.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+static int compare_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+void sample_set_add(sample_set *set, int64_t value)
+{
+    if(set->num_values == set->capacity) {
+        set->capacity = set->capacity == 0 ? 1024 : set->capacity * 2;
+        set->values = realloc(set->values, set->capacity * sizeof(int64_t));
+        assert(set->values != NULL);
+    }
+    set->values[set->num_values++] = value;
+}
+
+void sample_set_clear(sample_set *set)
+{
+    set->num_values = 0;
+}
+
+void sample_set_sort(sample_set *set)
+{
+    qsort(set->values, set->num_values, sizeof(int64_t), compare_int64);
+}
+
+int64_t sample_set_percentile(const sample_set *set, double percentile)
+{
+    if(set->num_values == 0) {
+        return 0;
+    }
+    size_t i = (size_t)(percentile / 100. * (set->num_values - 1) + 0.5);
+    return set->values[i < set->num_values ? i : set->num_values - 1];
+}
+
+double t_quantile_975(int df)
+{
+    // two-sided 95% quantiles of the t distribution, the normal quantile beyond 30 degrees of freedom
+    static const double table[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                   2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                   2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    return df <= 30 ? table[df - 1] : 1.96;
+}
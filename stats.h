@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct
+{
+    int64_t *values;
+    size_t num_values;
+    size_t capacity;
+} sample_set;
+
+void sample_set_add(sample_set *set, int64_t value);
+void sample_set_clear(sample_set *set);
+void sample_set_sort(sample_set *set);
+/* expects the set to be sorted */
+int64_t sample_set_percentile(const sample_set *set, double percentile);
+/* two-sided 95% quantile of the t distribution, for confidence intervals of a mean */
+double t_quantile_975(int df);
@@ -0,0 +1,98 @@
+#include "timestamps.h"
+
+#include <stdio.h>
+#include <sys/socket.h>
+
+#ifdef __linux__
+    #include <linux/net_tstamp.h>
+#endif
+
+static bool enabled = false;
+static int64_t last_rx_time_us = 0;
+
+void enable_rx_timestamps()
+{
+    enabled = true;
+}
+
+bool setup_rx_timestamps(int fd)
+{
+    if(!enabled) {
+        return true;
+    }
+
+    #ifdef __linux__
+        /* hardware timestamps are only reported if the NIC has rx timestamping enabled (e.g. via hwstamp_ctl) */
+        int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+                    SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+        if(setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) != 0) {
+            perror("setsockopt(SO_TIMESTAMPING) failed");
+            return false;
+        }
+        return true;
+    #else
+        fprintf(stderr, "kernel timestamps only supported on linux\n");
+        return false;
+    #endif
+}
+
+bool rx_timestamps_enabled()
+{
+    return enabled;
+}
+
+void rx_timestamps_record(rx_timestamps *ts, const recv_info *info)
+{
+    if(info->kernel_time_ns == 0) {
+        return;
+    }
+
+    // hardware timestamps come from the NIC clock, only use them for inter-arrival times
+    bool hw = info->hw_time_ns != 0;
+    int64_t time_ns = hw ? info->hw_time_ns : info->kernel_time_ns;
+    if(ts->num_packets > 0 && hw == ts->last_was_hw) {
+        sample_set_add(&ts->inter_arrival_ns, time_ns - ts->last_time_ns);
+    }
+    ts->last_time_ns = time_ns;
+    ts->last_was_hw = hw;
+
+    sample_set_add(&ts->sched_latency_ns, get_wall_time_us() * 1000 - info->kernel_time_ns);
+    last_rx_time_us = info->kernel_time_ns / 1000;
+
+    ++ts->num_packets;
+    if(hw) {
+        ++ts->num_hw_packets;
+    }
+}
+
+void rx_timestamps_report(rx_timestamps *ts, const char *prefix)
+{
+    sample_set *iat = &ts->inter_arrival_ns;
+    sample_set *lat = &ts->sched_latency_ns;
+    if(lat->num_values == 0) {
+        printf("%s: no timestamped packets\n", prefix);
+        return;
+    }
+
+    sample_set_sort(iat);
+    sample_set_sort(lat);
+    printf("%s: inter-arrival p50 %.1fus p99 %.1fus max %.1fus, kernel to app p50 %.1fus p99 %.1fus max %.1fus (%zu packets, %s timestamps)\n",
+           prefix,
+           sample_set_percentile(iat, 50) / 1000.,
+           sample_set_percentile(iat, 99) / 1000.,
+           sample_set_percentile(iat, 100) / 1000.,
+           sample_set_percentile(lat, 50) / 1000.,
+           sample_set_percentile(lat, 99) / 1000.,
+           sample_set_percentile(lat, 100) / 1000.,
+           lat->num_values,
+           ts->num_hw_packets > 0 ? "hardware" : "software");
+
+    sample_set_clear(iat);
+    sample_set_clear(lat);
+    ts->num_hw_packets = 0;
+}
+
+int64_t get_last_rx_time_us()
+{
+    return last_rx_time_us;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "common.h"
+#include "stats.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct
+{
+    int64_t last_time_ns;
+    bool last_was_hw;
+    uint64_t num_packets;
+    uint64_t num_hw_packets;
+    sample_set inter_arrival_ns;
+    sample_set sched_latency_ns;
+} rx_timestamps;
+
+void enable_rx_timestamps();
+bool rx_timestamps_enabled();
+/* applies the socket options if timestamps are enabled */
+bool setup_rx_timestamps(int fd);
+void rx_timestamps_record(rx_timestamps *ts, const recv_info *info);
+void rx_timestamps_report(rx_timestamps *ts, const char *prefix);
+/* kernel receive time of the last recorded packet in wall clock microseconds, 0 if unavailable */
+int64_t get_last_rx_time_us();
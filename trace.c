@@ -0,0 +1,280 @@
+#include "trace.h"
+#include "common.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* per thread, a power of two, 2MB buffer ~65ms of events at 1M events/s while the writer sleeps for 10ms */
+#define TRACE_RING_SIZE (1 << 16)
+#define MAX_TRACE_RINGS 8
+#define WRITER_SLEEP_US 10000
+
+typedef struct
+{
+    // written by the tracing thread only
+    _Alignas(64) atomic_size_t head;
+    atomic_uint_fast64_t dropped;
+    // written by the writer thread only
+    _Alignas(64) atomic_size_t tail;
+    uint64_t reported_dropped;
+    trace_event events[TRACE_RING_SIZE];
+} trace_ring;
+
+static bool enabled = false;
+static const char *trace_path;
+static FILE *out;
+static bool binary_format;
+static int64_t start_time_us;
+static trace_ring *rings[MAX_TRACE_RINGS];
+static atomic_int num_rings;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local trace_ring *local_ring = NULL;
+static pthread_t writer_thread;
+static atomic_bool stopping;
+static uint64_t events_written = 0;
+static uint64_t events_dropped = 0;
+
+static const char *cc_state_names[] = {"", "slow_start", "congestion_avoidance", "recovery"};
+
+static trace_ring *register_ring()
+{
+    pthread_mutex_lock(&rings_lock);
+    int n = atomic_load(&num_rings);
+    if(n < MAX_TRACE_RINGS) {
+        local_ring = calloc(1, sizeof(trace_ring));
+        if(local_ring != NULL) {
+            rings[n] = local_ring;
+            atomic_store_explicit(&num_rings, n + 1, memory_order_release);
+        }
+    }
+    pthread_mutex_unlock(&rings_lock);
+    return local_ring;
+}
+
+static void trace_record(uint32_t conn_id, trace_event_type type, uint64_t a, uint32_t b, uint32_t c)
+{
+    trace_ring *ring = local_ring != NULL ? local_ring : register_ring();
+    if(ring == NULL) {
+        return;
+    }
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if(head - atomic_load_explicit(&ring->tail, memory_order_acquire) == TRACE_RING_SIZE) {
+        // never block the connection, the writer reports the gap
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    trace_event *e = &ring->events[head & (TRACE_RING_SIZE - 1)];
+    e->time_us = get_time_us();
+    e->conn_id = conn_id;
+    e->type = type;
+    e->reserved = 0;
+    e->a = a;
+    e->b = b;
+    e->c = c;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+static void write_qlog(const trace_event *e)
+{
+    static const char *names[] = {
+        "transport:datagrams_sent",
+        "transport:packet_received",
+        "qperf:packets_acked",
+        "qperf:packets_lost",
+        "recovery:metrics_updated",
+        "recovery:congestion_state_updated",
+        "transport:stream_state_updated",
+        "transport:stream_state_updated",
+        "qperf:events_dropped",
+    };
+
+    fprintf(out, "\x1e{\"time\":%.3f,\"group_id\":\"%" PRIu32 "\",\"name\":\"%s\",\"data\":{", (e->time_us - start_time_us) / 1000.,
+            e->conn_id, names[e->type]);
+    switch(e->type) {
+    case TRACE_DATAGRAMS_SENT:
+        fprintf(out, "\"count\":%" PRIu32 ",\"raw\":{\"length\":%" PRIu64 "}", e->b, e->a);
+        break;
+    case TRACE_PACKET_RECEIVED:
+        fprintf(out, "\"raw\":{\"length\":%" PRIu64 "}", e->a);
+        break;
+    case TRACE_PACKETS_ACKED:
+    case TRACE_PACKETS_LOST:
+    case TRACE_EVENTS_DROPPED:
+        fprintf(out, "\"count\":%" PRIu64, e->a);
+        break;
+    case TRACE_METRICS_UPDATED:
+        fprintf(out, "\"congestion_window\":%" PRIu64 ",\"smoothed_rtt\":%" PRIu32 ",\"min_rtt\":%" PRIu32, e->a, e->b, e->c);
+        break;
+    case TRACE_CC_STATE_UPDATED:
+        fprintf(out, "\"new\":\"%s\"", cc_state_names[e->b]);
+        break;
+    case TRACE_STREAM_OPENED:
+    case TRACE_STREAM_CLOSED:
+        fprintf(out, "\"stream_id\":%" PRIu64 ",\"new\":\"%s\"", e->a, e->type == TRACE_STREAM_OPENED ? "open" : "closed");
+        break;
+    }
+    fputs("}}\n", out);
+}
+
+static void write_event(const trace_event *e)
+{
+    if(binary_format) {
+        fwrite(e, sizeof(*e), 1, out);
+    } else {
+        write_qlog(e);
+    }
+    ++events_written;
+}
+
+static size_t drain_rings()
+{
+    size_t num_events = 0;
+    int n = atomic_load_explicit(&num_rings, memory_order_acquire);
+    for(int i = 0; i < n; ++i) {
+        trace_ring *ring = rings[i];
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        for(size_t pos = tail; pos != head; ++pos) {
+            write_event(&ring->events[pos & (TRACE_RING_SIZE - 1)]);
+        }
+        atomic_store_explicit(&ring->tail, head, memory_order_release);
+        num_events += head - tail;
+
+        uint64_t dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+        if(dropped != ring->reported_dropped) {
+            trace_event e = {.time_us = get_time_us(), .conn_id = 0, .type = TRACE_EVENTS_DROPPED,
+                             .a = dropped - ring->reported_dropped};
+            write_event(&e);
+            events_dropped += e.a;
+            ring->reported_dropped = dropped;
+        }
+    }
+    return num_events;
+}
+
+static void *writer_main(void *arg)
+{
+    while(true) {
+        bool stop = atomic_load(&stopping);
+        if(drain_rings() == 0) {
+            if(stop) {
+                break;
+            }
+            usleep(WRITER_SLEEP_US);
+        }
+    }
+    return NULL;
+}
+
+static void trace_close()
+{
+    atomic_store(&stopping, true);
+    pthread_join(writer_thread, NULL);
+    fclose(out);
+    printf("trace: %" PRIu64 " events written to %s, %" PRIu64 " dropped\n", events_written, trace_path, events_dropped);
+}
+
+bool trace_open(const char *path, bool binary, const char *vantage_point)
+{
+    out = fopen(path, "w");
+    if(out == NULL) {
+        perror("opening trace file failed");
+        return false;
+    }
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+    trace_path = path;
+    binary_format = binary;
+    start_time_us = get_time_us();
+
+    if(binary) {
+        fwrite("QPTRACE1", 8, 1, out);
+    } else {
+        fprintf(out, "\x1e{\"qlog_version\":\"0.3\",\"qlog_format\":\"JSON-SEQ\",\"title\":\"qperf\",\"trace\":{\"vantage_point\":"
+                "{\"type\":\"%s\"},\"common_fields\":{\"time_format\":\"relative\",\"reference_time\":%.3f}}}\n",
+                vantage_point, get_wall_time_us() / 1000.);
+    }
+
+    int ret = pthread_create(&writer_thread, NULL, &writer_main, NULL);
+    if(ret != 0) {
+        fprintf(stderr, "pthread_create failed: %s\n", strerror(ret));
+        return false;
+    }
+    // the client and server end with exit(), the writer flushes the rings from there
+    atexit(&trace_close);
+    enabled = true;
+    return true;
+}
+
+bool trace_enabled()
+{
+    return enabled;
+}
+
+static inline uint32_t conn_id(quicly_conn_t *conn)
+{
+    return quicly_get_master_id(conn)->master_id;
+}
+
+void trace_datagrams_sent(quicly_conn_t *conn, size_t num_dgrams, size_t bytes)
+{
+    if(enabled) {
+        trace_record(conn_id(conn), TRACE_DATAGRAMS_SENT, bytes, num_dgrams, 0);
+    }
+}
+
+void trace_packet_received(quicly_conn_t *conn, size_t bytes)
+{
+    if(enabled) {
+        trace_record(conn_id(conn), TRACE_PACKET_RECEIVED, bytes, 0, 0);
+    }
+}
+
+void trace_conn_update(quicly_conn_t *conn, trace_conn *last)
+{
+    quicly_stats_t stats;
+    if(!enabled || quicly_get_stats(conn, &stats) != 0) {
+        return;
+    }
+    uint32_t id = conn_id(conn);
+
+    if(stats.num_packets.ack_received != last->packets_acked) {
+        trace_record(id, TRACE_PACKETS_ACKED, stats.num_packets.ack_received - last->packets_acked, 0, 0);
+        last->packets_acked = stats.num_packets.ack_received;
+    }
+    if(stats.num_packets.lost != last->packets_lost) {
+        trace_record(id, TRACE_PACKETS_LOST, stats.num_packets.lost - last->packets_lost, 0, 0);
+        last->packets_lost = stats.num_packets.lost;
+    }
+
+    // recovery lasts from a new loss episode until the window grows again
+    trace_cc_state state = last->cc_state;
+    if(stats.cc.num_loss_episodes != last->loss_episodes) {
+        state = TRACE_CC_RECOVERY;
+    } else if(state != TRACE_CC_RECOVERY || stats.cc.cwnd > last->cwnd) {
+        state = stats.cc.ssthresh == UINT32_MAX ? TRACE_CC_SLOW_START : TRACE_CC_CONGESTION_AVOIDANCE;
+    }
+    if(state != last->cc_state) {
+        trace_record(id, TRACE_CC_STATE_UPDATED, 0, state, 0);
+        last->cc_state = state;
+    }
+    last->loss_episodes = stats.cc.num_loss_episodes;
+
+    if(stats.cc.cwnd != last->cwnd || stats.rtt.smoothed != last->srtt || stats.rtt.minimum != last->min_rtt) {
+        trace_record(id, TRACE_METRICS_UPDATED, stats.cc.cwnd, stats.rtt.smoothed, stats.rtt.minimum);
+        last->cwnd = stats.cc.cwnd;
+        last->srtt = stats.rtt.smoothed;
+        last->min_rtt = stats.rtt.minimum;
+    }
+}
+
+void trace_stream(quicly_stream_t *stream, bool opened)
+{
+    if(enabled) {
+        trace_record(conn_id(stream->conn), opened ? TRACE_STREAM_OPENED : TRACE_STREAM_CLOSED, stream->stream_id, 0, 0);
+    }
+}
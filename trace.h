@@ -0,0 +1,58 @@
+#pragma once
+
+#include <quicly.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum
+{
+    TRACE_DATAGRAMS_SENT,    // a: bytes, b: datagrams
+    TRACE_PACKET_RECEIVED,   // a: bytes
+    TRACE_PACKETS_ACKED,     // a: packets
+    TRACE_PACKETS_LOST,      // a: packets
+    TRACE_METRICS_UPDATED,   // a: congestion window, b: smoothed rtt (ms), c: minimum rtt (ms)
+    TRACE_CC_STATE_UPDATED,  // b: trace_cc_state
+    TRACE_STREAM_OPENED,     // a: stream id
+    TRACE_STREAM_CLOSED,     // a: stream id
+    TRACE_EVENTS_DROPPED,    // a: events, written by the writer thread
+} trace_event_type;
+
+typedef enum
+{
+    TRACE_CC_SLOW_START = 1,
+    TRACE_CC_CONGESTION_AVOIDANCE,
+    TRACE_CC_RECOVERY,
+} trace_cc_state;
+
+/* record layout of the binary format, which starts with the 8 bytes "QPTRACE1", host byte order */
+typedef struct
+{
+    int64_t time_us;  // monotonic clock
+    uint32_t conn_id; // master id of the connection's CIDs
+    uint16_t type;
+    uint16_t reserved;
+    uint64_t a;
+    uint32_t b;
+    uint32_t c;
+} trace_event;
+
+/* last values of a connection, to only trace changes */
+typedef struct
+{
+    uint32_t cwnd;
+    uint32_t srtt;
+    uint32_t min_rtt;
+    uint64_t packets_acked;
+    uint64_t packets_lost;
+    uint32_t loss_episodes;
+    trace_cc_state cc_state;
+} trace_conn;
+
+/* starts the writer thread, vantage_point is "client" or "server" */
+bool trace_open(const char *path, bool binary, const char *vantage_point);
+bool trace_enabled();
+void trace_datagrams_sent(quicly_conn_t *conn, size_t num_dgrams, size_t bytes);
+void trace_packet_received(quicly_conn_t *conn, size_t bytes);
+/* traces acks, losses, cc state and rtt changes since the last call */
+void trace_conn_update(quicly_conn_t *conn, trace_conn *last);
+void trace_stream(quicly_stream_t *stream, bool opened);